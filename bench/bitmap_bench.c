@@ -0,0 +1,156 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-21
+ */
+
+/**
+ * Host side benchmark of bitmap_scan(). It links lib/kernel/bitmap.c and
+ * lib/string.c into a normal program, so it only declares the few libc
+ * functions it needs instead of including the libc headers, which would
+ * clash with the kernel ones.
+ *
+ * The bitmap models the kernel pool of a 128MB machine, one bit per 4KB
+ * page, with 90% of the bits set. Each round scans for 'cnt' free bits and
+ * allocates them as vaddr_get() does, so later scans have to walk further.
+ * The first results of every algorithm are compared to catch mistakes.
+ */
+#include "bitmap.h"
+#include "stdint.h"
+#include "string.h"
+
+int printf(const char *format, ...);
+void exit(int status);
+void *calloc(unsigned long nmemb, unsigned long size);
+
+#define POOL_BYTES (128 * 1024 * 1024)
+#define POOL_BITS (POOL_BYTES / 4096)
+#define BMAP_BYTES (POOL_BITS / 8)
+#define ROUNDS 200
+
+void panic_spin(char *filename, int line, const char *func,
+                const char *condition) {
+  printf("panic: %s:%d %s(): %s\n", filename, line, func, condition);
+  exit(1);
+}
+
+void user_spin(char *filename, int line, const char *func,
+               const char *condition) {
+  panic_spin(filename, line, func, condition);
+}
+
+static inline uint64_t rdtsc(void) {
+  uint32_t low, high;
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+  return ((uint64_t)high << 32) | low;
+}
+
+/* bitmap_scan() as it was before the word-at-a-time rewrite */
+static int legacy_bitmap_scan(struct bitmap *btmp, uint32_t cnt) {
+  uint32_t byte_idx = 0;
+  while ((0xff == btmp->bits[byte_idx]) && (byte_idx < btmp->bmap_bytes_len))
+    ++byte_idx;
+  if (byte_idx == btmp->bmap_bytes_len)
+    return -1;
+
+  int bit_idx = 0;
+  while ((uint8_t)(BITMAP_MASK << bit_idx) & btmp->bits[byte_idx])
+    ++bit_idx;
+
+  int bit_idx_start = byte_idx * 8 + bit_idx;
+  if (cnt == 1)
+    return bit_idx_start;
+
+  uint32_t bit_remaining = (btmp->bmap_bytes_len * 8 - bit_idx_start);
+  uint32_t next_bit = bit_idx_start + 1;
+  uint32_t count = 1;
+
+  bit_idx_start = -1;
+  while (bit_remaining-- > 0) {
+    if (!(bitmap_bit_test(btmp, next_bit))) {
+      ++count;
+    } else {
+      count = 0;
+    }
+    if (count == cnt) {
+      bit_idx_start = next_bit - cnt + 1;
+      break;
+    }
+    ++next_bit;
+  }
+  return bit_idx_start;
+}
+
+/**
+ * fill_pool - Fill 90% of the bitmap with a fixed pseudo random pattern.
+ * @btmp: A pointer to the bitmap.
+ *
+ * Used runs of 1~80 bits alternate with free runs of 1~8 bits, which looks
+ * like a long running kernel heap more than independent random bits do.
+ */
+static void fill_pool(struct bitmap *btmp) {
+  uint32_t seed = 20231221;
+  uint32_t bit_idx = 0;
+  bitmap_init(btmp);
+  while (bit_idx < POOL_BITS) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t used = (seed >> 16) % 80 + 1;
+    seed = seed * 1103515245 + 12345;
+    uint32_t free = (seed >> 16) % 8 + 1;
+    while (used-- > 0 && bit_idx < POOL_BITS)
+      bitmap_set(btmp, bit_idx++, 1);
+    bit_idx += free;
+  }
+}
+
+/* average cycles of a scan while ROUNDS runs of 'cnt' bits are allocated */
+static uint64_t run(struct bitmap *btmp, uint32_t cnt,
+                    int (*scan)(struct bitmap *, uint32_t)) {
+  uint64_t cycles = 0;
+  uint32_t round, idx;
+  for (round = 0; round < ROUNDS; round++) {
+    uint64_t start = rdtsc();
+    int bit_idx_start = scan(btmp, cnt);
+    cycles += rdtsc() - start;
+    if (bit_idx_start == -1) {
+      printf("pool exhausted at round %u\n", round);
+      exit(1);
+    }
+    for (idx = 0; idx < cnt; idx++)
+      bitmap_set(btmp, bit_idx_start + idx, 1);
+  }
+  return cycles / ROUNDS;
+}
+
+int main(void) {
+  static uint8_t bits[BMAP_BYTES];
+  uint32_t *summary = calloc(1, BITMAP_SUMMARY_BYTES(BMAP_BYTES));
+  struct bitmap btmp = {.bmap_bytes_len = BMAP_BYTES, .bits = bits};
+  uint32_t cnts[] = {1, 2, 4};
+  uint32_t i;
+
+  printf("pool: %d pages, 90%% used, %d rounds\n", POOL_BITS, ROUNDS);
+  printf("%6s %14s %14s %14s\n", "cnt", "legacy", "word", "word+summary");
+  for (i = 0; i < sizeof(cnts) / sizeof(cnts[0]); i++) {
+    uint64_t legacy, word, hier;
+    int expect, got;
+
+    fill_pool(&btmp);
+    expect = legacy_bitmap_scan(&btmp, cnts[i]);
+    legacy = run(&btmp, cnts[i], legacy_bitmap_scan);
+
+    fill_pool(&btmp);
+    got = bitmap_scan(&btmp, cnts[i]);
+    word = run(&btmp, cnts[i], bitmap_scan);
+
+    fill_pool(&btmp);
+    bitmap_summary_init(&btmp, summary);
+    hier = run(&btmp, cnts[i], bitmap_scan);
+
+    if (expect != got) {
+      printf("mismatch: legacy %d, word %d\n", expect, got);
+      return 1;
+    }
+    printf("%6u %14llu %14llu %14llu\n", cnts[i], legacy, word, hier);
+  }
+  return 0;
+}
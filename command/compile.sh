@@ -15,7 +15,7 @@ BIN="prog_no_arg"
 CFLAGS="-m32 -Wall -c -fno-builtin -W -Wsystem-headers -fno-stack-protector "
 LIB="../lib/"
 OBJS="../build/string.o ../build/syscall.o \
-      ../build/stdio.o ../build/assert.o"
+      ../build/stdio.o ../build/assert.o ../build/malloc.o"
 DD_IN=$BIN
 DD_OUT="/home/elite-zx/bochs/hd60M.img"
 
@@ -27,5 +27,5 @@ echo $SEC_CNT
 
 if [[ -f $BIN ]]; then
   dd if=./$DD_IN of=$DD_OUT bs=512 \
-    count=$SEC_CNT seek=300 conv=notrunc
+    count=$SEC_CNT seek=400 conv=notrunc
 fi
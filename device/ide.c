@@ -14,6 +14,7 @@
 #include "stdio_kernel.h"
 #include "string.h"
 #include "sync.h"
+#include "thread.h"
 #include "timer.h"
 
 /* port number decided by channel number  */
@@ -244,6 +245,21 @@ static void write_to_sector(struct disk *hd, void *buf, uint8_t sector_cnt) {
   outsw(reg_data(hd->which_channel), buf, size_in_byte / 2);
 }
 
+/**
+ * disk_wait() - Sleep until the disk raises its interrupt.
+ * @hd: Pointer to the disk structure.
+ *
+ * The task is marked as waiting for a device, so the scheduler boosts it when
+ * the interrupt handler wakes it up.
+ */
+static void disk_wait(struct disk *hd) {
+  struct task_struct *cur = running_thread();
+  cur->io_wait = true;
+  sema_down(&hd->which_channel->disk_done);
+  /* not blocked at all if the interrupt came first */
+  cur->io_wait = false;
+}
+
 /**
  * busy_wait() - Wait for the disk to become ready.
  * @hd: Pointer to the disk structure.
@@ -307,7 +323,7 @@ void ide_read(struct disk *hd, uint32_t LBA, void *buf, uint32_t sector_cnt) {
 
     /* semaphore disk_done's initial value is 0, so sema_down means block
      * itself, that is, hard disk driver */
-    sema_down(&hd->which_channel->disk_done);
+    disk_wait(hd);
 
     /* hard disk driver is Woken up by hard disk interrupt handler */
 
@@ -365,7 +381,7 @@ void ide_write(struct disk *hd, uint32_t LBA, void *buf, uint32_t sector_cnt) {
 
     write_to_sector(hd, (void *)((uint32_t)buf + sector_done * 512),
                     sector_operate);
-    sema_down(&hd->which_channel->disk_done);
+    disk_wait(hd);
     sector_done += sector_operate;
   }
   lock_release(&hd->which_channel->_lock);
@@ -414,7 +430,7 @@ static void identify_disk(struct disk *hd) {
 
   /* disk start working, I (the hard driver) gonna to sleep -_- ᶻ𝗓 , CPU will
    * execute other processes/threads or thread idle */
-  sema_down(&hd->which_channel->disk_done);
+  disk_wait(hd);
 
   /* hard disk driver is Woken up by hard disk interrupt handler */
   if (!busy_wait(hd)) {
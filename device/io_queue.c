@@ -70,6 +70,8 @@ bool ioq_is_empty(struct ioqueue *ioq) {
 static void ioq_wait(struct task_struct **waiter) {
   ASSERT(waiter != NULL && *waiter == NULL);
   *waiter = running_thread();
+  /* waiting for the keyboard, boosted when woken up */
+  (*waiter)->io_wait = true;
   thread_block(TASK_BLOCKED);
 }
 
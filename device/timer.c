@@ -10,21 +10,56 @@
 #include "stdint.h"
 #include "thread.h"
 
-#define IRQ0_FREQUENCY 100
 #define INPUT_FREQUENCY 1193180
-#define COUNTER0_VALUE INPUT_FREQUENCY / IRQ0_FREQUENCY
+#define COUNTER0_VALUE (INPUT_FREQUENCY / IRQ0_FREQUENCY)
 #define COUNTER0_PORT 0x40
 
+#if IRQ0_FREQUENCY < 19 || IRQ0_FREQUENCY > 10000
+#error "IRQ0_FREQUENCY must be within 19 to 10000"
+#endif
+
 #define COUNTER0_NO 0
+/* mode 2 (rate generator) gives periodic ticks, mode 0 (interrupt on
+ * terminal count) a single interrupt */
 #define COUNTER0_MODE 2
+#define COUNTER0_ONESHOT_MODE 0
 #define READ_WRITE_LATCH 3
 #define PIT_CONTROL_PORT 0x43
 
-#define millisecond_per_intr (1000 / IRQ0_FREQUENCY)
+/* counter2 is gated by bit 0 of port 0x61, and its output is read back from
+ * bit 5 */
+#define COUNTER2_NO 2
+#define COUNTER2_PORT 0x42
+#define PIT_GATE_PORT 0x61
+#define PIT_GATE_ON 0x01
+#define PIT_SPEAKER_ON 0x02
+#define PIT_OUT2 0x20
+
+/* the TSC is counted against counter2 for this long, below 55ms (16 bits) */
+#define TSC_CALIBRATE_MS 50
+/* CPUID.1:EDX bit 4, the CPU has a time stamp counter */
+#define CPUID_EDX_TSC 0x10
+/* ns = cycles * tsc_mult >> TSC_SHIFT */
+#define TSC_SHIFT 22
+#define NS_PER_TICK (1000000000 / IRQ0_FREQUENCY)
+
+/* the most counts one one-shot of the 16-bit counter lasts, about 55ms */
+#define ONESHOT_MAX_COUNT 0xffff
+/* the idle task sleeps at most one second, so the ticks to catch up with
+ * stay few */
+#define IDLE_MAX_TICKS IRQ0_FREQUENCY
+#define MLFQ_BOOST_TICKS (MLFQ_BOOST_MS * IRQ0_FREQUENCY / 1000)
 
 /* the total number of ticks since the interrupt was enabled  */
 uint32_t ticks;
 
+/* slots of the timing wheel, a power of 2  */
+#define TIMER_WHEEL_SLOTS 64
+
+/* sleeping tasks, in the slot of their wake_tick modulo TIMER_WHEEL_SLOTS,
+ * linked by general_tag which a blocked task does not use otherwise  */
+static struct list timer_wheel[TIMER_WHEEL_SLOTS];
+
 /**
  * frequency_set - Initialize programmable Interval Timer Intel 8253
  * @counter_port: as to counter NO.0, this value is 0x40
@@ -44,43 +79,356 @@ static void frequency_set(uint8_t counter_port, uint8_t counter_no, uint8_t rwl,
   /* low 8 bits of the initial count value of counter0  */
   outb(counter_port, (uint8_t)counter_value);
   /* high 8 bits of the initial count value of counter0  */
-  outb(counter_port, (uint8_t)counter_value >> 8);
+  outb(counter_port, (uint8_t)(counter_value >> 8));
+}
+
+/* the current value of counter0, latched so both bytes belong together */
+static uint16_t counter_read(void) {
+  outb(PIT_CONTROL_PORT, (uint8_t)(COUNTER0_NO << 6));
+  uint8_t low = inb(COUNTER0_PORT);
+  uint8_t high = inb(COUNTER0_PORT);
+  return (uint16_t)(high << 8 | low);
+}
+
+/* the TSC frequency in kHz, 0 if there is no usable TSC  */
+uint32_t tsc_khz;
+/* nanoseconds per cycle, scaled by 2^TSC_SHIFT  */
+static uint32_t tsc_mult;
+/* the TSC when it was calibrated, which is time 0 of clock_ns()  */
+static uint64_t tsc_base;
+
+static inline uint64_t rdtsc(void) {
+  uint64_t tsc;
+  asm volatile("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
+/**
+ * div_u64 - Divide a 64-bit number by a 32-bit one.
+ * @dividend: The number to divide.
+ * @divisor: The number to divide by, not 0.
+ * @remainder: Set to the remainder if not NULL.
+ *
+ * Two 'divl' do it, so the kernel needs no 64-bit division of libgcc.
+ *
+ * Return: The quotient.
+ */
+static uint64_t div_u64(uint64_t dividend, uint32_t divisor,
+                        uint32_t *remainder) {
+  uint32_t high = (uint32_t)(dividend >> 32);
+  uint32_t low = (uint32_t)dividend;
+  uint32_t quot_high = high / divisor;
+  uint32_t quot_low, rem;
+  asm("divl %4"
+      : "=a"(quot_low), "=d"(rem)
+      : "a"(low), "d"(high % divisor), "rm"(divisor));
+  if (remainder != NULL)
+    *remainder = rem;
+  return (uint64_t)quot_high << 32 | quot_low;
+}
+
+/**
+ * tsc_calibrate - Measure the frequency of the time stamp counter.
+ *
+ * counter2 of the PIT, whose input frequency is known, counts down
+ * TSC_CALIBRATE_MS once in mode 0 while the TSC is read before and after.
+ * counter0 and its interrupt are not involved, so this works before the
+ * interrupt is enabled. Without a TSC, or with one too slow to be of use,
+ * tsc_khz stays 0 and the clocks fall back to the ticks.
+ */
+static void tsc_calibrate(void) {
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  if (!(edx & CPUID_EDX_TSC)) {
+    put_str("   no TSC\n");
+    return;
+  }
+
+  /* gate counter2 on, keep the speaker off */
+  outb(PIT_GATE_PORT,
+       (inb(PIT_GATE_PORT) & ~PIT_SPEAKER_ON) | PIT_GATE_ON);
+  frequency_set(COUNTER2_PORT, COUNTER2_NO, READ_WRITE_LATCH,
+                COUNTER0_ONESHOT_MODE,
+                INPUT_FREQUENCY * TSC_CALIBRATE_MS / 1000);
+  uint64_t start = rdtsc();
+  while (!(inb(PIT_GATE_PORT) & PIT_OUT2))
+    ;
+  uint64_t cycles = rdtsc() - start;
+
+  uint32_t khz = (uint32_t)div_u64(cycles, TSC_CALIBRATE_MS, NULL);
+  /* tsc_mult would overflow below 1MHz */
+  if (khz < 1000) {
+    put_str("   TSC too slow\n");
+    return;
+  }
+  tsc_mult = (uint32_t)div_u64((uint64_t)1000000 << TSC_SHIFT, khz, NULL);
+  tsc_base = rdtsc();
+  tsc_khz = khz;
+  put_str("   TSC kHz: 0x");
+  put_int(tsc_khz);
+  put_str("\n");
+}
+
+/* the TSC, or 0 if there is no usable TSC  */
+uint64_t tsc_read(void) {
+  return tsc_khz != 0 ? rdtsc() : 0;
+}
+
+/* convert cycles of the TSC to nanoseconds, without 64-bit division  */
+uint64_t cycles_to_ns(uint64_t cycles) {
+  uint32_t low = (uint32_t)cycles;
+  uint32_t high = (uint32_t)(cycles >> 32);
+  return ((uint64_t)low * tsc_mult >> TSC_SHIFT) +
+         ((uint64_t)high * tsc_mult << (32 - TSC_SHIFT));
+}
+
+/**
+ * clock_ns - The monotonic time since the TSC was calibrated.
+ *
+ * Reading the TSC and one multiplication make it cheap, and its resolution
+ * is a cycle rather than a tick. Without a TSC it is the ticks, which keep
+ * counting through tickless idle as well.
+ *
+ * Return: The time in nanoseconds.
+ */
+uint64_t clock_ns(void) {
+  if (tsc_khz == 0)
+    return (uint64_t)ticks * NS_PER_TICK;
+  return cycles_to_ns(rdtsc() - tsc_base);
+}
+
+/**
+ * sys_clock_gettime - Read a clock.
+ * @clock_id: CLOCK_MONOTONIC or CLOCK_PROCESS_CPUTIME_ID.
+ * @tp: Set to the time of the clock.
+ *
+ * The CPU time of a task is the TSC cycles it ran for, charged at every
+ * context switch (see schedule()), or its ticks without a TSC.
+ *
+ * Return: 0 on success, -1 if the clock is unknown.
+ */
+int32_t sys_clock_gettime(uint32_t clock_id, struct timespec *tp) {
+  uint64_t ns;
+  if (clock_id == CLOCK_MONOTONIC) {
+    ns = clock_ns();
+  } else if (clock_id == CLOCK_PROCESS_CPUTIME_ID) {
+    if (tsc_khz == 0)
+      ns = (uint64_t)running_thread()->elapsed_ticks * NS_PER_TICK;
+    else
+      ns = cycles_to_ns(thread_cpu_cycles());
+  } else {
+    return -1;
+  }
+  uint32_t nsec;
+  tp->tv_sec = (uint32_t)div_u64(ns, 1000000000, &nsec);
+  tp->tv_nsec = nsec;
+  return 0;
+}
+
+/**
+ * timer_wheel_expire - Wake up the tasks whose deadline is this tick.
+ *
+ * Only the slot of the current tick is looked at. The tasks in it whose
+ * deadline is some turns of the wheel later stay there, so a tick costs
+ * O(1) plus the tasks sharing the slot, however many tasks sleep.
+ */
+static void timer_wheel_expire(void) {
+  struct list *slot = &timer_wheel[ticks & (TIMER_WHEEL_SLOTS - 1)];
+  struct list_elem *elem = slot->head.next;
+  while (elem != &slot->tail) {
+    struct list_elem *next = elem->next;
+    struct task_struct *pthread =
+        elem2entry(struct task_struct, general_tag, elem);
+    if (pthread->wake_tick == ticks) {
+      list_remove(elem);
+      thread_unblock(pthread);
+    }
+    elem = next;
+  }
+}
+
+/* one tick of time passes  */
+static void timer_tick(void) {
+  ++ticks;
+  timer_wheel_expire();
+  if (ticks % MLFQ_BOOST_TICKS == 0)
+    thread_boost_all();
+}
+
+/**
+ * timer_wheel_next - Ticks until the first deadline on the timing wheel.
+ * @limit: The most ticks to look ahead.
+ *
+ * Every sleeping task is looked at, including those some turns of the wheel
+ * ahead, which costs O(sleepers) but is only done when the CPU goes idle.
+ *
+ * Return: The number of ticks, or 'limit' if nothing expires before.
+ */
+static uint32_t timer_wheel_next(uint32_t limit) {
+  uint32_t next = limit, slot_idx;
+  for (slot_idx = 0; slot_idx < TIMER_WHEEL_SLOTS; slot_idx++) {
+    struct list *slot = &timer_wheel[slot_idx];
+    struct list_elem *elem;
+    for (elem = slot->head.next; elem != &slot->tail; elem = elem->next) {
+      struct task_struct *pthread =
+          elem2entry(struct task_struct, general_tag, elem);
+      uint32_t delta = pthread->wake_tick - ticks;
+      if (delta < next)
+        next = delta;
+    }
+  }
+  return next;
+}
+
+/* the count loaded into counter0 in one-shot mode, 0 in periodic mode  */
+static uint32_t oneshot_count;
+/* counts of the one-shot chain still to be loaded after the current one,
+ * and counts of the one-shots of the chain that already expired  */
+static uint32_t oneshot_left;
+static uint32_t oneshot_done;
+/* counts of counter0 that passed but do not make a whole tick yet  */
+static uint32_t count_residue;
+
+/* load the next one-shot of the chain, as long as the counter allows  */
+static void oneshot_load(void) {
+  oneshot_count =
+      oneshot_left < ONESHOT_MAX_COUNT ? oneshot_left : ONESHOT_MAX_COUNT;
+  oneshot_left -= oneshot_count;
+  frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH,
+                COUNTER0_ONESHOT_MODE, oneshot_count);
+}
+
+/**
+ * timer_periodic_restore - Leave one-shot mode.
+ * @elapsed_count: The counts of counter0 since one-shot mode was entered.
+ *
+ * The ticks that passed meanwhile are played one by one, so the sleepers
+ * that expired are woken up, and counter0 is set to periodic mode again.
+ */
+static void timer_periodic_restore(uint32_t elapsed_count) {
+  count_residue += elapsed_count;
+  while (count_residue >= COUNTER0_VALUE) {
+    count_residue -= COUNTER0_VALUE;
+    timer_tick();
+  }
+  oneshot_count = 0;
+  frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER0_MODE,
+                COUNTER0_VALUE);
+}
+
+/**
+ * timer_idle_enter - Stop the periodic tick while nothing is ready.
+ *
+ * Called by the idle task right before it halts. The time to the first
+ * deadline of the timing wheel, counted from the last tick and at most
+ * IDLE_MAX_TICKS, is split into a chain of one-shots of counter0, as one
+ * of the 16-bit counter lasts ONESHOT_MAX_COUNT at most. The interrupt of
+ * a one-shot that is not the last one only loads the next one, without a
+ * tick or a schedule, so the CPU is not woken up by ticks nothing waits for.
+ *
+ * Context: Interrupts disabled.
+ */
+void timer_idle_enter(void) {
+  ASSERT(intr_get_status() == INTR_OFF);
+  uint32_t sleep_ticks = timer_wheel_next(IDLE_MAX_TICKS);
+  /* the next periodic tick is as good */
+  if (sleep_ticks <= 1)
+    return;
+  /* the part of the current tick that already passed */
+  uint32_t partial = COUNTER0_VALUE - counter_read();
+  count_residue += partial;
+  oneshot_done = 0;
+  oneshot_left = sleep_ticks * COUNTER0_VALUE - partial;
+  oneshot_load();
+}
+
+/* the one-shot chain of the idle task has not reached its end yet  */
+bool timer_idle_pending(void) { return oneshot_count != 0; }
+
+/**
+ * timer_idle_exit - Restart the periodic tick after the idle task woke up.
+ *
+ * If another interrupt made a task ready before the chain reached its end,
+ * the time spent in the current one-shot is read back from counter0. A
+ * one-shot that expired just now, with its interrupt still pending, counts
+ * as one tick more later on.
+ */
+void timer_idle_exit(void) {
+  enum intr_status old_status = intr_disable();
+  if (oneshot_count != 0) {
+    uint32_t left = counter_read();
+    timer_periodic_restore(oneshot_done + (left <= oneshot_count
+                                               ? oneshot_count - left
+                                               : oneshot_count));
+  }
+  intr_set_status(old_status);
 }
 
 static void intr_time_handler() {
   struct task_struct *cur_thread = running_thread();
   ASSERT(cur_thread->stack_magic == 0x20011124);
 
+  if (oneshot_count != 0) {
+    /* a one-shot of the idle task expired, which is halted. Go on with the
+     * chain, or tick again once it reached the deadline */
+    oneshot_done += oneshot_count;
+    if (oneshot_left != 0)
+      oneshot_load();
+    else
+      timer_periodic_restore(oneshot_done);
+    return;
+  }
+
   ++cur_thread->elapsed_ticks;
-  ++ticks;
+  timer_tick();
 
   if (cur_thread->ticks == 0) {
     /* time slice of current thread is over */
     schedule();
   } else {
     --cur_thread->ticks;
+    /* a task of a higher level is ready, let it run now */
+    if (thread_preempt_pending())
+      schedule();
   }
 }
 
 /**
  * ticks_to_sleep - let task sleep for sleep_ticks ticks
- * sleep_ticks: the number of ticks to sleep
+ * sleep_ticks: the number of ticks to sleep, at least 1
+ *
+ * The task is put on the timing wheel and blocked, so it takes no CPU time
+ * until the timer interrupt of its deadline wakes it up.
  */
 static void ticks_to_sleep(uint32_t sleep_ticks) {
-  uint32_t start_ticks = sleep_ticks;
-  while (ticks - start_ticks < sleep_ticks) {
-    /* Yields the CPU */
-    thread_yield();
-  }
+  struct task_struct *cur_thread = running_thread();
+  enum intr_status old_status = intr_disable();
+  cur_thread->wake_tick = ticks + sleep_ticks;
+  list_append(&timer_wheel[cur_thread->wake_tick & (TIMER_WHEEL_SLOTS - 1)],
+              &cur_thread->general_tag);
+  thread_block(TASK_BLOCKED);
+  intr_set_status(old_status);
 }
 
 void mtime_sleep(uint32_t m_seconds) {
-  /* convert seconds to ticks  */
-  uint32_t sleep_ticks = DIV_ROUND_UP(m_seconds, millisecond_per_intr);
+  /* convert milliseconds to ticks, rounding up, without overflow  */
+  uint32_t sleep_ticks = m_seconds / 1000 * IRQ0_FREQUENCY +
+                         DIV_ROUND_UP(m_seconds % 1000 * IRQ0_FREQUENCY, 1000);
   ASSERT(sleep_ticks > 0);
   ticks_to_sleep(sleep_ticks);
 }
 
+/**
+ * sys_sleep - Let the calling process sleep.
+ * @m_seconds: The time to sleep in milliseconds, rounded up to ticks.
+ */
+void sys_sleep(uint32_t m_seconds) {
+  if (m_seconds == 0)
+    thread_yield();
+  else
+    mtime_sleep(m_seconds);
+}
+
 /**
  * timer_init - Initialize timer
  *
@@ -90,6 +438,11 @@ void mtime_sleep(uint32_t m_seconds) {
  */
 void timer_init() {
   put_str("timer_init start\n");
+  uint32_t slot;
+  for (slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+    list_init(&timer_wheel[slot]);
+  }
+  tsc_calibrate();
   frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER0_MODE,
                 COUNTER0_VALUE);
   register_handler(0x20, intr_time_handler);
@@ -5,7 +5,40 @@
 
 #ifndef __DEVICE_TIME_H
 #define __DEVICE_TIME_H
+#include "global.h"
 #include "stdint.h"
+
+/* timer interrupts per second, 'make HZ=n' sets it. The PIT cannot go below
+ * 19Hz, and slices and sleeps are whole ticks */
+#ifndef IRQ0_FREQUENCY
+#define IRQ0_FREQUENCY 100
+#endif
+
+/* clocks of sys_clock_gettime(): the time since boot, and the CPU time of
+ * the calling task */
+#define CLOCK_MONOTONIC 1
+#define CLOCK_PROCESS_CPUTIME_ID 2
+
+/**
+ * struct timespec - A time as seconds and nanoseconds.
+ * @tv_sec: Whole seconds.
+ * @tv_nsec: Nanoseconds, below 1000000000.
+ */
+struct timespec {
+  uint32_t tv_sec;
+  uint32_t tv_nsec;
+};
+
+extern uint32_t tsc_khz;
+
 void timer_init();
+uint64_t tsc_read(void);
+uint64_t cycles_to_ns(uint64_t cycles);
+uint64_t clock_ns(void);
+int32_t sys_clock_gettime(uint32_t clock_id, struct timespec *tp);
+void timer_idle_enter(void);
+bool timer_idle_pending(void);
+void timer_idle_exit(void);
 void mtime_sleep(uint32_t m_seconds);
+void sys_sleep(uint32_t m_seconds);
 #endif
@@ -11,6 +11,7 @@
 #include "ide.h"
 #include "inode.h"
 #include "memory.h"
+#include "slab.h"
 #include "stdint.h"
 #include "stdio_kernel.h"
 #include "string.h"
@@ -19,6 +20,9 @@
 struct dir root_dir;
 extern struct partition *cur_part;
 
+/* 'struct dir' is opened and closed for every component of a path */
+struct kmem_cache dir_cache;
+
 /**
  * open_root_dir() - Open the root directory of a partition.
  * @part: Pointer to the partition containing the root directory.
@@ -38,12 +42,13 @@ void open_root_dir(struct partition *part) {
  * @inode_no: The inode number of the directory to open.
  *
  * Opens a directory by its inode number in the given partition and returns
- * a pointer to the directory structure. Initializes the directory position.
+ * a pointer to the directory structure, which is taken from dir_cache.
+ * Initializes the directory position.
  */
 struct dir *dir_open(struct partition *part, uint32_t inode_NO) {
-  struct dir *pdir = (struct dir *)sys_malloc(sizeof(struct dir));
+  struct dir *pdir = (struct dir *)kmem_cache_alloc(&dir_cache);
   pdir->_inode = inode_open(part, inode_NO);
-  /* dir_buf in pdir are initialized to 0 by sys_malloc  */
+  /* dir_buf is only a scratch buffer of dir_read, no need to clear it  */
   pdir->dir_pos = 0;
   return pdir;
 }
@@ -137,15 +142,23 @@ bool search_dir_entry(struct partition *part, struct dir *pdir,
  *
  * Closes the specified directory. If the directory is the root directory,
  * it doesn't perform any operation, as the root directory should not be
- * closed. Otherwise, it closes the directory's inode and frees the directory
- * structure.
+ * closed. Otherwise, it closes the directory's inode and gives the directory
+ * structure back to dir_cache.
  */
 void dir_close(struct dir *dir) {
   /* root directory '/' can not be closed, so do nothing to it  */
   if (dir == &root_dir)
     return;
   inode_close(dir->_inode);
-  sys_free(dir);
+  dir_ctor(dir);
+  kmem_cache_free(&dir_cache, dir);
+}
+
+/* constructor of the objects in dir_cache, a closed dir refers to no inode */
+void dir_ctor(void *obj) {
+  struct dir *dir = obj;
+  dir->_inode = NULL;
+  dir->dir_pos = 0;
 }
 
 /**
@@ -533,14 +546,14 @@ int32_t dir_remove(struct dir *parent_dir, struct dir *child_dir) {
     block_idx++;
   }
 
-  void *io_buf = sys_malloc(SECTOR_SIZE * 2);
+  void *io_buf = kmem_cache_alloc(&io_buf_cache);
   if (io_buf == NULL) {
-    printk("dir_is_empty: sys_malloc for io_buf failed\n");
+    printk("dir_is_empty: kmem_cache_alloc for io_buf failed\n");
     return -1;
   }
 
   delete_dir_entry(cur_part, parent_dir, child_dir_inode->i_NO, io_buf);
   inode_release(cur_part, child_dir_inode->i_NO);
-  sys_free(io_buf);
+  kmem_cache_free(&io_buf_cache, io_buf);
   return 0;
 }
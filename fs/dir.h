@@ -8,6 +8,7 @@
 #include "fs.h"
 #include "global.h"
 #include "ide.h"
+#include "slab.h"
 #include "stdint.h"
 #define MAX_FILE_NAME_LEN 16
 
@@ -52,6 +53,8 @@ struct dir_entry {
   enum file_types f_type;
 };
 
+extern struct kmem_cache dir_cache;
+void dir_ctor(void *obj);
 bool search_dir_entry(struct partition *part, struct dir *pdir,
                       const char *name, struct dir_entry *dir_e);
 void dir_close(struct dir *dir);
@@ -161,9 +161,9 @@ void bitmap_sync(struct partition *part, uint32_t bit_idx, uint8_t btmp_flag) {
  */
 int32_t file_create(struct dir *parent_dir, char *filename, uint8_t flag) {
   /* Prepare buffer (two sectors size) for writing data to disk*/
-  void *io_buf = sys_malloc(1024);
+  void *io_buf = kmem_cache_alloc(&io_buf_cache);
   if (io_buf == NULL) {
-    printk("file_create: sys_malloc for io_buf failed\n");
+    printk("file_create: kmem_cache_alloc for io_buf failed\n");
     return -1;
   }
 
@@ -177,9 +177,9 @@ int32_t file_create(struct dir *parent_dir, char *filename, uint8_t flag) {
     printk("file_create: allocate inode bit failed\n");
     return -1;
   }
-  struct inode *new_inode = (struct inode *)sys_malloc(sizeof(struct inode));
+  struct inode *new_inode = (struct inode *)kmem_cache_alloc(&inode_cache);
   if (new_inode == NULL) {
-    printk("file_create: sys_malloc for inode failed\n");
+    printk("file_create: kmem_cache_alloc for inode failed\n");
     rollback_action = 3;
     /*  rollback ---free new inode bit in inode_bitmap  */
     goto rollback;
@@ -223,7 +223,7 @@ int32_t file_create(struct dir *parent_dir, char *filename, uint8_t flag) {
   list_push(&cur_part->open_inodes, &new_inode->inode_tag);
   new_inode->i_open_cnt = 1;
 
-  sys_free(io_buf);
+  kmem_cache_free(&io_buf_cache, io_buf);
 
   /* Install a global file descriptor index to the current thread's local fd
    * table. */
@@ -235,12 +235,12 @@ rollback:
   case 1:
     memset(&file_table[fd_idx], 0, sizeof(struct file));
   case 2:
-    sys_free(new_inode);
+    kmem_cache_free(&inode_cache, new_inode);
   case 3:
     bitmap_set(&cur_part->inode_bitmap, new_inode_NO, 1);
     break;
   }
-  sys_free(io_buf);
+  kmem_cache_free(&io_buf_cache, io_buf);
   return -1;
 }
 
@@ -15,9 +15,11 @@
 #include "keyboard.h"
 #include "list.h"
 #include "memory.h"
+#include "page_cache.h"
 #include "stdint.h"
 #include "stdio_kernel.h"
 #include "string.h"
+#include "swap.h"
 #include "super_block.h"
 #include "thread.h"
 
@@ -29,6 +31,9 @@ extern struct file file_table[MAX_FILES_OPEN];
 
 struct partition *cur_part;
 
+/* two-sector buffers for inode and directory entry I/O of the kernel */
+struct kmem_cache io_buf_cache;
+
 /**
  * mount_partition() - Mount a partition by name.
  * @pelem: Pointer to the partition list element.
@@ -105,6 +110,21 @@ static bool mount_partition(struct list_elem *pelem, const int arg) {
     ide_read(hd, _sup_b_buf->inode_bitmap_LBA, cur_part->inode_bitmap.bits,
              _sup_b_buf->inode_bitmap_sectors);
 
+    /* bitmaps are loaded from disk directly, build their summary levels */
+    cur_part->block_bitmap.summary = (uint32_t *)sys_malloc(
+        BITMAP_SUMMARY_BYTES(cur_part->block_bitmap.bmap_bytes_len));
+    cur_part->inode_bitmap.summary = (uint32_t *)sys_malloc(
+        BITMAP_SUMMARY_BYTES(cur_part->inode_bitmap.bmap_bytes_len));
+
+    if (cur_part->block_bitmap.summary == NULL ||
+        cur_part->inode_bitmap.summary == NULL)
+      PANIC("allocate memory failed!");
+
+    bitmap_summary_init(&cur_part->block_bitmap,
+                        cur_part->block_bitmap.summary);
+    bitmap_summary_init(&cur_part->inode_bitmap,
+                        cur_part->inode_bitmap.summary);
+
     list_init(&cur_part->open_inodes);
     printk("mount %s done!\n", part->name);
     return true;
@@ -287,6 +307,8 @@ static void partition_format(struct disk *_hd, struct partition *part) {
  * and only processes valid partitions. It supports only its own file system
  * type identified by the magic number 0x20011124.
  *
+ * The object caches of inodes, directories and I/O buffers, and the page
+ * cache, are set up first.
  * It also sets a default partition to operate on and opens the root directory
  * of the current partition. Finally, it initializes the global file table
  * for managing open files.
@@ -294,6 +316,11 @@ static void partition_format(struct disk *_hd, struct partition *part) {
 void filesys_init() {
   uint8_t channel_NO = 0, part_idx = 0;
   uint8_t dev_NO;
+  kmem_cache_init(&inode_cache, "inode", sizeof(struct inode), inode_ctor);
+  kmem_cache_init(&dir_cache, "dir", sizeof(struct dir), dir_ctor);
+  kmem_cache_init(&io_buf_cache, "io_buf", SECTOR_SIZE * 2, NULL);
+  page_cache_init();
+
   /* _sup_b_buf is the buffer used to store super_block(which is read from disk)
    */
   struct super_block *_sup_b_buf =
@@ -320,8 +347,8 @@ void filesys_init() {
            * partitions ^_^  */
           part = hd->logic_parts;
         }
-        /* partition exists or not  */
-        if (part->sector_cnt != 0) {
+        /* partition exists or not, the swap area is left alone  */
+        if (part->sector_cnt != 0 && part != swap_part) {
           memset(_sup_b_buf, 0, SECTOR_SIZE);
           /* '+1' here is to skip over the OBR sector and read super block which
            * located in the second sector of partition*/
@@ -791,10 +818,10 @@ int32_t sys_unlink(const char *pathname) {
 
   /* the file is not open and can be deleted  */
   ASSERT(file_idx == MAX_FILES_OPEN);
-  void *io_buf = sys_malloc(SECTOR_SIZE * 2);
+  void *io_buf = kmem_cache_alloc(&io_buf_cache);
   if (io_buf == NULL) {
     dir_close(searched_record.parent_dir);
-    printk("sys_unlink: sys_malloc for io_buf failed\n");
+    printk("sys_unlink: kmem_cache_alloc for io_buf failed\n");
     return -1;
   }
 
@@ -802,7 +829,7 @@ int32_t sys_unlink(const char *pathname) {
   delete_dir_entry(cur_part, parent_dir, inode_NO, io_buf);
 
   inode_release(cur_part, inode_NO);
-  sys_free(io_buf);
+  kmem_cache_free(&io_buf_cache, io_buf);
   dir_close(searched_record.parent_dir);
   return 0;
 }
@@ -822,9 +849,9 @@ int32_t sys_unlink(const char *pathname) {
 int32_t sys_mkdir(const char *pathname) {
   uint32_t rollback_action = 0;
 
-  void *io_buf = sys_malloc(SECTOR_SIZE * 2);
+  void *io_buf = kmem_cache_alloc(&io_buf_cache);
   if (io_buf == NULL) {
-    printk("sys_mkdir: sys_malloc for io_buf failed\n");
+    printk("sys_mkdir: kmem_cache_alloc for io_buf failed\n");
     return -1;
   }
   struct path_search_record searched_record;
@@ -910,7 +937,7 @@ int32_t sys_mkdir(const char *pathname) {
   inode_sync(cur_part, &new_dir_inode, io_buf);
   bitmap_sync(cur_part, new_inode_NO, INODE_BITMAP);
 
-  sys_free(io_buf);
+  kmem_cache_free(&io_buf_cache, io_buf);
   dir_close(parent_dir);
   return 0;
 
@@ -923,7 +950,7 @@ rollback:
     dir_close(searched_record.parent_dir);
     break;
   }
-  sys_free(io_buf);
+  kmem_cache_free(&io_buf_cache, io_buf);
   return -1;
 }
 
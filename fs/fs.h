@@ -5,6 +5,7 @@
 #ifndef __FS_FS_H
 #define __FS_FS_H
 
+#include "slab.h"
 #include "stdint.h"
 
 /* total number of inodes */
@@ -52,6 +53,7 @@ struct stat {
   enum file_types st_filetype;
 };
 
+extern struct kmem_cache io_buf_cache;
 void filesys_init();
 char *path_parse(char *pathname, char *name_buf);
 int32_t sys_open(const char *pathname, uint8_t flag);
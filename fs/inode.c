@@ -10,6 +10,8 @@
 #include "interrupt.h"
 #include "list.h"
 #include "memory.h"
+#include "page_cache.h"
+#include "slab.h"
 #include "stdint.h"
 #include "stdio_kernel.h"
 #include "string.h"
@@ -17,6 +19,9 @@
 #include "thread.h"
 
 extern struct partition *cur_part;
+
+/* in-memory inodes are shared by all tasks, so they come from a kernel cache */
+struct kmem_cache inode_cache;
 /**
  * struct inode_position - Store the position of an inode.
  * @is_inode_cross_sectors: Indicates if the inode spans across two sectors.
@@ -125,8 +130,8 @@ void inode_sync(struct partition *part, struct inode *inode, void *io_buf) {
  * partition. It first searches the partition's open inode list and returns the
  * inode if found. If the inode is not in the open list, the function reads it
  * from the disk, adds it to the open list, and returns it. This function
- * handles the case where an inode spans two sectors. The function ensures that
- * the inode memory is allocated from the kernel memory pool
+ * handles the case where an inode spans two sectors. The inode memory is
+ * allocated from inode_cache, so that the inode can be shared between tasks.
  */
 struct inode *inode_open(struct partition *part, uint32_t inode_NO) {
   struct list_elem *inode_iter = part->open_inodes.head.next;
@@ -152,21 +157,13 @@ struct inode *inode_open(struct partition *part, uint32_t inode_NO) {
   struct inode_position inode_pos;
   inode_locate(part, inode_NO, &inode_pos);
 
-  /* set pg_dir to NULL temporarily so that sys_malloc mistakenly think it is a
-   * kernel thread, ensuring that the inode allocates memory from the kernel
-   * heap space, thereby realizing the sharing of inodes between tasks. */
-  struct task_struct *cur = running_thread();
-  uint32_t *cur_pgdir_backup = cur->pg_dir;
-  cur->pg_dir = NULL;
-  inode_found = (struct inode *)sys_malloc(sizeof(struct inode));
-  cur->pg_dir = cur_pgdir_backup;
+  inode_found = (struct inode *)kmem_cache_alloc(&inode_cache);
 
-  char *inode_buf;
+  /* io_buf_cache holds two sectors, enough for an inode crossing sectors */
+  char *inode_buf = (char *)kmem_cache_alloc(&io_buf_cache);
   if (inode_pos.is_inode_cross_sectors) {
-    inode_buf = (char *)sys_malloc(512 * 2);
     ide_read(part->which_disk, inode_pos.sector_LBA, inode_buf, 2);
   } else {
-    inode_buf = (char *)sys_malloc(512);
     ide_read(part->which_disk, inode_pos.sector_LBA, inode_buf, 1);
   }
   memcpy(inode_found, inode_buf + inode_pos.offset_in_sector,
@@ -174,7 +171,7 @@ struct inode *inode_open(struct partition *part, uint32_t inode_NO) {
 
   list_push(&part->open_inodes, &inode_found->inode_tag);
   inode_found->i_open_cnt = 1;
-  sys_free(inode_buf);
+  kmem_cache_free(&io_buf_cache, inode_buf);
   return inode_found;
 }
 
@@ -184,22 +181,34 @@ struct inode *inode_open(struct partition *part, uint32_t inode_NO) {
  *
  * This function decreases the open count of the given inode. If the open count
  * reaches zero, indicating no more processes are using this inode, it removes
- * the inode from the open inode list of its partition and frees the memory. The
- * function ensures that the inode memory is freed from the kernel memory pool.
+ * the inode from the open inode list of its partition, drops its pages from
+ * the page cache and gives it back to inode_cache.
  */
 void inode_close(struct inode *inode) {
   enum intr_status old_status = intr_disable();
   if (--inode->i_open_cnt == 0) {
+    page_cache_release(inode);
     list_remove(&inode->inode_tag);
-    struct task_struct *cur = running_thread();
-    uint32_t *cur_pgdir_backup = cur->pg_dir;
-    cur->pg_dir = NULL;
-    sys_free(inode);
-    cur->pg_dir = cur_pgdir_backup;
+    inode->inode_tag.prev = inode->inode_tag.next = NULL;
+    kmem_cache_free(&inode_cache, inode);
   }
   intr_set_status(old_status);
 }
 
+/**
+ * inode_ctor() - Constructor of the objects in inode_cache.
+ * @obj: The inode to construct.
+ *
+ * A closed inode is not on any open_inodes list and is opened by nobody, which
+ * is also the state inode_close() leaves it in before giving it back.
+ */
+void inode_ctor(void *obj) {
+  struct inode *inode = obj;
+  inode->i_open_cnt = 0;
+  inode->write_deny = false;
+  inode->inode_tag.prev = inode->inode_tag.next = NULL;
+}
+
 /**
  * inode_init() - Initialize a new inode.
  * @inode_no: The number of the new inode.
@@ -326,8 +335,8 @@ void inode_release(struct partition *part, uint32_t inode_NO) {
   bitmap_set(&part->inode_bitmap, inode_NO, 0);
   bitmap_sync(cur_part, inode_NO, INODE_BITMAP);
 
-  void *io_buf = sys_malloc(1024);
+  void *io_buf = kmem_cache_alloc(&io_buf_cache);
   inode_delete(part, inode_NO, io_buf);
-  sys_free(io_buf);
+  kmem_cache_free(&io_buf_cache, io_buf);
   inode_close(inode_to_del);
 }
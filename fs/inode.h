@@ -7,6 +7,7 @@
 #include "global.h"
 #include "ide.h"
 #include "list.h"
+#include "slab.h"
 #include "stdint.h"
 
 /**
@@ -33,6 +34,8 @@ struct inode {
   struct list_elem inode_tag;
 };
 
+extern struct kmem_cache inode_cache;
+void inode_ctor(void *obj);
 void inode_close(struct inode *inode);
 void inode_init(uint32_t inode_NO, struct inode *new_inode);
 void inode_sync(struct partition *part, struct inode *inode, void *io_buf);
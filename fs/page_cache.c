@@ -0,0 +1,341 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-28
+ */
+#include "page_cache.h"
+#include "debug.h"
+#include "file.h"
+#include "fs.h"
+#include "global.h"
+#include "ide.h"
+#include "inode.h"
+#include "interrupt.h"
+#include "list.h"
+#include "memory.h"
+#include "slab.h"
+#include "stdint.h"
+#include "stdio_kernel.h"
+#include "thread.h"
+#include "vma.h"
+
+#define SECTORS_PER_PAGE (PAGE_SIZE / SECTOR_SIZE)
+
+extern struct partition *cur_part;
+extern struct file file_table[MAX_FILES_OPEN];
+
+/**
+ * struct page_cache_entry - A page of a file held in memory.
+ * @inode: The inode of the file, open as long as it has cached pages.
+ * @pg_idx: The index of the page in the file.
+ * @page_phy_addr: The page frame holding the data.
+ * @uptodate: False while the page is being read from the disk.
+ * @hash_tag: Element in the hash bucket of (inode, pg_idx).
+ *
+ * The cache owns one reference to the frame, and every process mapping the
+ * page is one more sharer of it (see page_share_map()). Pages stay cached
+ * until the inode is closed for the last time.
+ */
+struct page_cache_entry {
+  struct inode *inode;
+  uint32_t pg_idx;
+  phys_addr_t page_phy_addr;
+  bool uptodate;
+  struct list_elem hash_tag;
+};
+
+static struct list page_cache_hash[PAGE_CACHE_BUCKETS];
+static struct kmem_cache page_cache_entry_cache;
+/* number of pages in the page cache */
+uint32_t page_cache_pages;
+
+/**
+ * page_cache_init() - Initialize the page cache.
+ */
+void page_cache_init(void) {
+  uint32_t bucket_idx;
+  for (bucket_idx = 0; bucket_idx < PAGE_CACHE_BUCKETS; bucket_idx++) {
+    list_init(&page_cache_hash[bucket_idx]);
+  }
+  kmem_cache_init(&page_cache_entry_cache, "page_cache",
+                  sizeof(struct page_cache_entry), NULL);
+}
+
+static struct list *page_cache_bucket(struct inode *inode, uint32_t pg_idx) {
+  return &page_cache_hash[(inode->i_NO * 31 + pg_idx) % PAGE_CACHE_BUCKETS];
+}
+
+static struct page_cache_entry *page_cache_find(struct inode *inode,
+                                                uint32_t pg_idx) {
+  struct list *bucket = page_cache_bucket(inode, pg_idx);
+  struct list_elem *elem = bucket->head.next;
+  while (elem != &bucket->tail) {
+    struct page_cache_entry *entry =
+        elem2entry(struct page_cache_entry, hash_tag, elem);
+    if (entry->inode == inode && entry->pg_idx == pg_idx)
+      return entry;
+    elem = elem->next;
+  }
+  return NULL;
+}
+
+/**
+ * page_cache_sectors() - Look up the sectors holding a page of a file.
+ * @inode: The inode of the file.
+ * @pg_idx: The index of the page in the file.
+ * @sectors_lba: Filled with the LBA of each sector of the page, 0 for the
+ * sectors past the end of the file.
+ *
+ * Return: True on success, false if no buffer was left for the indirect
+ * block table.
+ */
+static bool page_cache_sectors(struct inode *inode, uint32_t pg_idx,
+                               uint32_t *sectors_lba) {
+  uint32_t *indirect_table = NULL;
+  uint32_t sec_idx;
+  for (sec_idx = 0; sec_idx < SECTORS_PER_PAGE; sec_idx++) {
+    uint32_t block_idx = pg_idx * SECTORS_PER_PAGE + sec_idx;
+    sectors_lba[sec_idx] = 0;
+    if (block_idx * BLOCK_SIZE >= inode->i_size)
+      break;
+    if (block_idx < 12) {
+      sectors_lba[sec_idx] = inode->i_blocks[block_idx];
+      continue;
+    }
+    if (indirect_table == NULL) {
+      indirect_table = kmem_cache_alloc(&io_buf_cache);
+      if (indirect_table == NULL)
+        return false;
+      ide_read(cur_part->which_disk, inode->i_blocks[12], indirect_table, 1);
+    }
+    sectors_lba[sec_idx] = indirect_table[block_idx - 12];
+  }
+  if (indirect_table != NULL)
+    kmem_cache_free(&io_buf_cache, indirect_table);
+  return true;
+}
+
+/**
+ * page_cache_fault() - Map a page of a file mapping on its first touch.
+ * @vma: The VM_FILE region containing 'vaddr'.
+ * @vaddr: The faulting user virtual address, page aligned.
+ *
+ * A page that is not cached yet gets a frame, which is mapped at 'vaddr' and
+ * filled from the disk right there, without a bounce buffer. A page that is
+ * being read by another process is waited for. The part of the page past the
+ * end of the file reads as zeros.
+ *
+ * Context: Called by the #PF handler, may block on the disk.
+ * Return: True if the page was mapped, false if no memory is left.
+ */
+bool page_cache_fault(struct vm_area *vma, uint32_t vaddr) {
+  struct inode *inode = vma->file;
+  uint32_t pg_idx = vma->pgoff + (vaddr - vma->start) / PAGE_SIZE;
+  uint32_t sectors_lba[SECTORS_PER_PAGE];
+
+  enum intr_status old_status = intr_disable();
+  struct page_cache_entry *entry = page_cache_find(inode, pg_idx);
+  struct page_cache_entry *new_entry = NULL;
+  if (entry == NULL) {
+    new_entry = kmem_cache_alloc(&page_cache_entry_cache);
+    if (new_entry == NULL) {
+      intr_set_status(old_status);
+      return false;
+    }
+    new_entry->page_phy_addr = frame_alloc_zeroed(PF_USER);
+    if (new_entry->page_phy_addr == 0) {
+      kmem_cache_free(&page_cache_entry_cache, new_entry);
+      intr_set_status(old_status);
+      return false;
+    }
+    /* the allocation may block, another process may have cached the page
+     * meanwhile */
+    entry = page_cache_find(inode, pg_idx);
+    if (entry != NULL) {
+      pfree(new_entry->page_phy_addr);
+      kmem_cache_free(&page_cache_entry_cache, new_entry);
+    }
+  }
+
+  if (entry != NULL) {
+    while (!entry->uptodate) {
+      thread_yield();
+    }
+    page_share_map(vaddr, entry->page_phy_addr);
+  } else {
+    entry = new_entry;
+    entry->inode = inode;
+    entry->pg_idx = pg_idx;
+    entry->uptodate = false;
+    list_append(page_cache_bucket(inode, pg_idx), &entry->hash_tag);
+    page_cache_pages++;
+
+    /* a page that can not be read is left zero-filled */
+    page_share_map(vaddr, entry->page_phy_addr);
+    if (page_cache_sectors(inode, pg_idx, sectors_lba)) {
+      uint32_t sec_idx;
+      for (sec_idx = 0; sec_idx < SECTORS_PER_PAGE; sec_idx++) {
+        if (sectors_lba[sec_idx] == 0)
+          break;
+        ide_read(cur_part->which_disk, sectors_lba[sec_idx],
+                 (void *)(vaddr + sec_idx * SECTOR_SIZE), 1);
+      }
+    }
+    entry->uptodate = true;
+  }
+  page_set_prot(vaddr, (vma->flags & VM_WRITE) != 0);
+  intr_set_status(old_status);
+  return true;
+}
+
+/**
+ * page_cache_writeback() - Write a page of a file mapping back if it is dirty.
+ * @vma: The VM_FILE region containing 'vaddr'.
+ * @vaddr: A user virtual address in the current process, page aligned.
+ *
+ * Only the sectors within the file are written, a mapping never extends the
+ * file.
+ */
+static void page_cache_writeback(struct vm_area *vma, uint32_t vaddr) {
+  if (!page_mapped(vaddr) || !(*pte_ptr(vaddr) & PG_D))
+    return;
+  uint32_t pg_idx = vma->pgoff + (vaddr - vma->start) / PAGE_SIZE;
+  uint32_t sectors_lba[SECTORS_PER_PAGE];
+  if (!page_cache_sectors(vma->file, pg_idx, sectors_lba)) {
+    printk("page_cache_writeback: kmem_cache_alloc for io_buf failed\n");
+    return;
+  }
+  uint32_t sec_idx;
+  for (sec_idx = 0; sec_idx < SECTORS_PER_PAGE; sec_idx++) {
+    if (sectors_lba[sec_idx] == 0)
+      break;
+    ide_write(cur_part->which_disk, sectors_lba[sec_idx],
+              (void *)(vaddr + sec_idx * SECTOR_SIZE), 1);
+  }
+  page_set_prot(vaddr, true);
+}
+
+/**
+ * page_cache_release() - Drop all cached pages of a file.
+ * @inode: The inode of the file, being closed for the last time.
+ *
+ * No process maps the pages any more, since every mapping holds an open
+ * count of the inode, so the frames go back to the user pool.
+ */
+void page_cache_release(struct inode *inode) {
+  enum intr_status old_status = intr_disable();
+  uint32_t bucket_idx;
+  for (bucket_idx = 0; bucket_idx < PAGE_CACHE_BUCKETS; bucket_idx++) {
+    struct list *bucket = &page_cache_hash[bucket_idx];
+    struct list_elem *elem = bucket->head.next;
+    while (elem != &bucket->tail) {
+      struct page_cache_entry *entry =
+          elem2entry(struct page_cache_entry, hash_tag, elem);
+      elem = elem->next;
+      if (entry->inode != inode)
+        continue;
+      list_remove(&entry->hash_tag);
+      pfree(entry->page_phy_addr);
+      kmem_cache_free(&page_cache_entry_cache, entry);
+      page_cache_pages--;
+    }
+  }
+  intr_set_status(old_status);
+}
+
+/**
+ * sys_mmap() - Map a regular file, or anonymous memory, into the address
+ * space of the process.
+ * @fd: The file descriptor of the file, or -1 for anonymous memory.
+ * @offset: The offset in the file where the mapping starts, page aligned.
+ * Ignored for anonymous memory.
+ * @length: The length of the mapping in bytes.
+ *
+ * Anonymous memory is private to the process, copy-on-write after fork, and
+ * zero-filled on the first touch of each page.
+ *
+ * The mapping is shared: its pages are the pages of the page cache, so every
+ * process mapping the same part of the file sees the same data, and the data
+ * is read from the disk only once, on the first touch of each page. It is
+ * writable if the file was opened for writing, dirty pages are written back
+ * by sys_munmap(). A child created by fork shares the mapping.
+ *
+ * The page cache is not consulted by sys_read() and sys_write(), so data
+ * written through one of them is not seen through the other until the file
+ * is closed and mapped again.
+ *
+ * Return: The address of the mapping, or NULL if 'fd' is not an open file,
+ * the range is not within the file, or there is no room.
+ */
+void *sys_mmap(int32_t fd, uint32_t offset, uint32_t length) {
+  struct task_struct *cur = running_thread();
+  if (cur->pg_dir == NULL || length == 0 || length > 0xc0000000)
+    return NULL;
+  if (fd == -1) {
+    return (void *)vma_alloc(cur, DIV_ROUND_UP(length, PAGE_SIZE) * PAGE_SIZE,
+                             VM_READ | VM_WRITE);
+  }
+  if (fd < 3 || fd >= MAX_FILES_OPEN_PER_PROC ||
+      cur->fd_table[fd] == -1 || offset % PAGE_SIZE != 0)
+    return NULL;
+
+  struct file *file = &file_table[cur->fd_table[fd]];
+  struct inode *inode = file->fd_inode;
+  uint32_t pg_cnt = DIV_ROUND_UP(length, PAGE_SIZE);
+  if (offset / PAGE_SIZE + pg_cnt > DIV_ROUND_UP(inode->i_size, PAGE_SIZE))
+    return NULL;
+
+  uint32_t flags = VM_READ | VM_SHARED | VM_FILE;
+  if (file->fd_flag & (O_WRONLY | O_RDWR))
+    flags |= VM_WRITE;
+  uint32_t vaddr = vma_alloc(cur, pg_cnt * PAGE_SIZE, flags);
+  if (vaddr == 0)
+    return NULL;
+
+  struct vm_area *vma = vma_find(cur, vaddr);
+  vma->file = inode;
+  vma->pgoff = offset / PAGE_SIZE;
+  enum intr_status old_status = intr_disable();
+  inode->i_open_cnt++;
+  intr_set_status(old_status);
+  return (void *)vaddr;
+}
+
+/**
+ * sys_munmap() - Remove a mapping.
+ * @addr: The address returned by sys_mmap().
+ * @length: The length given to sys_mmap().
+ *
+ * Writes the dirty pages back to the file before unmapping them. Only a
+ * whole file mapping can be removed, but any page aligned part of anonymous
+ * memory can.
+ *
+ * Return: 0 on success, -1 if there is no such mapping.
+ */
+int32_t sys_munmap(void *addr, uint32_t length) {
+  struct task_struct *cur = running_thread();
+  if (cur->pg_dir == NULL || (uint32_t)addr % PAGE_SIZE != 0 || length == 0)
+    return -1;
+  struct vm_area *vma = vma_find(cur, (uint32_t)addr);
+  if (vma != NULL && !(vma->flags & (VM_FILE | VM_SHARED | VM_STACK))) {
+    uint32_t pg_cnt = DIV_ROUND_UP(length, PAGE_SIZE);
+    if (pg_cnt > (vma->end - (uint32_t)addr) / PAGE_SIZE)
+      return -1;
+    mfree_page(PF_USER, addr, pg_cnt);
+    return 0;
+  }
+  if (vma == NULL || !(vma->flags & VM_FILE) ||
+      vma->start != (uint32_t)addr ||
+      DIV_ROUND_UP(length, PAGE_SIZE) != (vma->end - vma->start) / PAGE_SIZE)
+    return -1;
+
+  struct inode *inode = vma->file;
+  uint32_t pg_cnt = (vma->end - vma->start) / PAGE_SIZE;
+  uint32_t vaddr;
+  for (vaddr = vma->start; vaddr < vma->end; vaddr += PAGE_SIZE) {
+    page_cache_writeback(vma, vaddr);
+  }
+  /* the region is gone after this */
+  mfree_page(PF_USER, addr, pg_cnt);
+  inode_close(inode);
+  return 0;
+}
@@ -0,0 +1,21 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-28
+ */
+#ifndef __FS_PAGE_CACHE_H
+#define __FS_PAGE_CACHE_H
+#include "global.h"
+#include "inode.h"
+#include "stdint.h"
+#include "vma.h"
+
+/* number of hash buckets of the page cache */
+#define PAGE_CACHE_BUCKETS 64
+
+extern uint32_t page_cache_pages;
+void page_cache_init(void);
+bool page_cache_fault(struct vm_area *vma, uint32_t vaddr);
+void page_cache_release(struct inode *inode);
+void *sys_mmap(int32_t fd, uint32_t offset, uint32_t length);
+int32_t sys_munmap(void *addr, uint32_t length);
+#endif
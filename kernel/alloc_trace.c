@@ -0,0 +1,205 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-30
+ */
+#include "alloc_trace.h"
+#include "file.h"
+#include "fs.h"
+#include "global.h"
+#include "interrupt.h"
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+#include "thread.h"
+
+#ifdef TRACE_ALLOC
+/**
+ * struct alloc_record - A live allocation.
+ * @ptr: The address returned to the caller, NULL for an empty slot.
+ * @caller: The return address into the code that asked for the memory.
+ * @size: The size asked for, in bytes.
+ * @pid: The task that allocated it.
+ *
+ * User addresses are private to a process, so a user allocation only matches
+ * a lookup from the same task.
+ */
+struct alloc_record {
+  void *ptr;
+  void *caller;
+  uint32_t size;
+  pid_t pid;
+};
+
+/**
+ * struct alloc_site - The outstanding allocations of one call site.
+ * @caller: The return address of the call site.
+ * @cnt: The number of live allocations made there.
+ * @bytes: Their total size.
+ */
+struct alloc_site {
+  void *caller;
+  uint32_t cnt;
+  uint32_t bytes;
+};
+
+/* open addressing with linear probing, hashed by address */
+static struct alloc_record alloc_table[ALLOC_TRACE_SLOTS];
+static uint32_t alloc_cnt;
+/* allocations not recorded because the table was full */
+static uint32_t alloc_lost;
+
+static uint32_t alloc_hash(void *ptr) {
+  return (((uint32_t)ptr >> 4) * 2654435761U) >> (32 - ALLOC_TRACE_BITS);
+}
+
+static bool alloc_match(struct alloc_record *rec, void *ptr, pid_t pid) {
+  return rec->ptr == ptr &&
+         ((uint32_t)ptr >= 0xc0000000 || rec->pid == pid);
+}
+
+/**
+ * alloc_trace_add() - Record a new allocation.
+ * @ptr: The address returned to the caller, NULL if the allocation failed.
+ * @size: The size asked for, in bytes.
+ * @caller: The return address into the caller.
+ *
+ * An allocation recorded again replaces the record, so when an allocator is
+ * built on another one, the outermost call site is kept.
+ */
+void alloc_trace_add(void *ptr, uint32_t size, void *caller) {
+  if (ptr == NULL)
+    return;
+  pid_t pid = running_thread()->pid;
+  enum intr_status old_status = intr_disable();
+  uint32_t idx = alloc_hash(ptr);
+  while (alloc_table[idx].ptr != NULL &&
+         !alloc_match(&alloc_table[idx], ptr, pid)) {
+    idx = (idx + 1) & (ALLOC_TRACE_SLOTS - 1);
+  }
+  if (alloc_table[idx].ptr == NULL) {
+    /* one slot is always left empty to end the probing */
+    if (alloc_cnt == ALLOC_TRACE_SLOTS - 1) {
+      alloc_lost++;
+      intr_set_status(old_status);
+      return;
+    }
+    alloc_cnt++;
+  }
+  alloc_table[idx].ptr = ptr;
+  alloc_table[idx].caller = caller;
+  alloc_table[idx].size = size;
+  alloc_table[idx].pid = pid;
+  intr_set_status(old_status);
+}
+
+/**
+ * alloc_trace_del() - Forget a freed allocation.
+ * @ptr: The address being freed.
+ *
+ * The records after the removed one in its probe sequence are shifted back,
+ * so that no tombstone is needed. Freeing an address that was not recorded
+ * (an internal allocation, or one lost to a full table) is ignored.
+ */
+void alloc_trace_del(void *ptr) {
+  pid_t pid = running_thread()->pid;
+  enum intr_status old_status = intr_disable();
+  uint32_t idx = alloc_hash(ptr);
+  while (alloc_table[idx].ptr != NULL &&
+         !alloc_match(&alloc_table[idx], ptr, pid)) {
+    idx = (idx + 1) & (ALLOC_TRACE_SLOTS - 1);
+  }
+  if (alloc_table[idx].ptr == NULL) {
+    intr_set_status(old_status);
+    return;
+  }
+  alloc_cnt--;
+
+  uint32_t hole = idx;
+  uint32_t next = (idx + 1) & (ALLOC_TRACE_SLOTS - 1);
+  while (alloc_table[next].ptr != NULL) {
+    uint32_t home = alloc_hash(alloc_table[next].ptr);
+    /* move the record into the hole unless its home lies in (hole, next] */
+    if (((next - home) & (ALLOC_TRACE_SLOTS - 1)) >=
+        ((next - hole) & (ALLOC_TRACE_SLOTS - 1))) {
+      alloc_table[hole] = alloc_table[next];
+      hole = next;
+    }
+    next = (next + 1) & (ALLOC_TRACE_SLOTS - 1);
+  }
+  alloc_table[hole].ptr = NULL;
+  intr_set_status(old_status);
+}
+
+/**
+ * sys_alloc_dump() - Print the outstanding allocations grouped by call site.
+ *
+ * The sites with the most outstanding bytes come first. A site is printed as
+ * a return address, which build/kernel.map or addr2line on build/kernel.bin
+ * turn into a function. A site whose count only grows over a long run is
+ * leaking.
+ */
+void sys_alloc_dump(void) {
+  char line[80];
+  struct alloc_site sites[ALLOC_TRACE_SITES];
+  uint32_t site_cnt = 0, other_cnt = 0, other_bytes = 0;
+
+  /* aggregate under one snapshot of the table */
+  enum intr_status old_status = intr_disable();
+  uint32_t idx, site_idx;
+  for (idx = 0; idx < ALLOC_TRACE_SLOTS; idx++) {
+    struct alloc_record *rec = &alloc_table[idx];
+    if (rec->ptr == NULL)
+      continue;
+    for (site_idx = 0; site_idx < site_cnt; site_idx++) {
+      if (sites[site_idx].caller == rec->caller)
+        break;
+    }
+    if (site_idx == site_cnt) {
+      if (site_cnt == ALLOC_TRACE_SITES) {
+        other_cnt++;
+        other_bytes += rec->size;
+        continue;
+      }
+      sites[site_cnt].caller = rec->caller;
+      sites[site_cnt].cnt = 0;
+      sites[site_cnt].bytes = 0;
+      site_cnt++;
+    }
+    sites[site_idx].cnt++;
+    sites[site_idx].bytes += rec->size;
+  }
+  uint32_t live_cnt = alloc_cnt, lost_cnt = alloc_lost;
+  intr_set_status(old_status);
+
+  /* selection sort by bytes, there are few sites */
+  for (idx = 0; idx < site_cnt; idx++) {
+    uint32_t max_idx = idx;
+    for (site_idx = idx + 1; site_idx < site_cnt; site_idx++) {
+      if (sites[site_idx].bytes > sites[max_idx].bytes)
+        max_idx = site_idx;
+    }
+    struct alloc_site tmp = sites[idx];
+    sites[idx] = sites[max_idx];
+    sites[max_idx] = tmp;
+  }
+
+  sprintf(line, "alloc trace: %d live, %d lost\nCALLER        COUNT   BYTES\n",
+          live_cnt, lost_cnt);
+  sys_write(STDOUT_NO, line, strlen(line));
+  for (idx = 0; idx < site_cnt; idx++) {
+    sprintf(line, "0x%x    %d       %d\n", (uint32_t)sites[idx].caller,
+            sites[idx].cnt, sites[idx].bytes);
+    sys_write(STDOUT_NO, line, strlen(line));
+  }
+  if (other_cnt > 0) {
+    sprintf(line, "(other)       %d       %d\n", other_cnt, other_bytes);
+    sys_write(STDOUT_NO, line, strlen(line));
+  }
+}
+#else
+/* without TRACE_ALLOC nothing is recorded, tell how to turn it on */
+void sys_alloc_dump(void) {
+  char *off = "alloc trace: off, rebuild with 'make TRACE_ALLOC=1'\n";
+  sys_write(STDOUT_NO, off, strlen(off));
+}
+#endif
@@ -0,0 +1,29 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-30
+ */
+#ifndef __KERNEL_ALLOC_TRACE_H
+#define __KERNEL_ALLOC_TRACE_H
+#include "global.h"
+#include "stdint.h"
+
+/* the table holds 2^ALLOC_TRACE_BITS live allocations */
+#define ALLOC_TRACE_BITS 10
+#define ALLOC_TRACE_SLOTS (1 << ALLOC_TRACE_BITS)
+/* number of distinct call sites reported by sys_alloc_dump() */
+#define ALLOC_TRACE_SITES 32
+
+/* 'make TRACE_ALLOC=1 ...' records every live allocation, see alloc_trace.c */
+#ifdef TRACE_ALLOC
+#define ALLOC_TRACE_ADD(ptr, size)                                             \
+  alloc_trace_add((ptr), (size), __builtin_return_address(0))
+#define ALLOC_TRACE_DEL(ptr) alloc_trace_del(ptr)
+#else
+#define ALLOC_TRACE_ADD(ptr, size)
+#define ALLOC_TRACE_DEL(ptr)
+#endif
+
+void alloc_trace_add(void *ptr, uint32_t size, void *caller);
+void alloc_trace_del(void *ptr);
+void sys_alloc_dump(void);
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-22
+ */
+#include "bench.h"
+#include "global.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "stdint.h"
+#include "stdio_kernel.h"
+
+/* number of pages touched after every reload of CR3 */
+#define TLB_BENCH_PAGES 64
+/* 2^TLB_BENCH_ROUNDS_SHIFT rounds are averaged, which avoids 64-bit division */
+#define TLB_BENCH_ROUNDS_SHIFT 10
+
+/* PDE 768 as created by setup_page in loader.S: global 4MB page at 0 (the
+ * first of two 2MB pages with PAE) */
+#define PG_PS 0x80
+#define KERNEL_PDE_4M (PG_PS | PG_G | PG_US_U | PG_RW_W | PG_P_1)
+/* the page table of PDE 0, which maps the low 1MB with 4KB pages */
+#ifdef PAE
+#define LOW_1M_PT_PHY_ADDR 0x105000
+#else
+#define LOW_1M_PT_PHY_ADDR 0x101000
+#endif
+
+#define CR4_PGE 0x80
+
+static inline uint64_t rdtsc(void) {
+  uint32_t low, high;
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+  return ((uint64_t)high << 32) | low;
+}
+
+static inline uint32_t cr4_read(void) {
+  uint32_t cr4;
+  asm volatile("movl %%cr4, %0" : "=r"(cr4));
+  return cr4;
+}
+
+/* writing CR4.PGE flushes the whole TLB, global entries included */
+static inline void cr4_write(uint32_t cr4) {
+  asm volatile("movl %0, %%cr4" ::"r"(cr4) : "memory");
+}
+
+/**
+ * tlb_walk - Measure the cost of kernel TLB misses after a reload of CR3.
+ * @pages: The kernel pages to touch.
+ * @cnt: The number of pages.
+ *
+ * Every round reloads CR3, as page_dir_activate() does on a switch between
+ * processes, then reads one word from each page.
+ *
+ * Return: The average number of cycles per round.
+ */
+static uint32_t tlb_walk(uint32_t *pages[], uint32_t cnt) {
+  uint32_t round, idx;
+  uint64_t start = rdtsc();
+  for (round = 0; round < (1 << TLB_BENCH_ROUNDS_SHIFT); round++) {
+    asm volatile("movl %%cr3, %%eax; movl %%eax, %%cr3" ::: "eax", "memory");
+    for (idx = 0; idx < cnt; idx++) {
+      (void)*(volatile uint32_t *)pages[idx];
+    }
+  }
+  return (uint32_t)((rdtsc() - start) >> TLB_BENCH_ROUNDS_SHIFT);
+}
+
+/**
+ * tlb_bench - Compare kernel TLB misses on context switch with and without
+ * 4MB global kernel pages.
+ *
+ * Two sets of pages are walked: pages of the kernel image, mapped by the 4MB
+ * page of PDE 768, and pages of the kernel heap, mapped by 4KB global PTEs.
+ * The "before" layout is rebuilt on the fly by pointing PDE 768 back to the
+ * 4KB page table of the low 1MB and clearing CR4.PGE, which is how the kernel
+ * was mapped before. Both layouts map the same frames, so the kernel keeps
+ * running while they are swapped.
+ *
+ * Context: Called once at boot, with 'make BENCH=1', before any process runs.
+ */
+void tlb_bench(void) {
+  uint32_t *image_pages[TLB_BENCH_PAGES];
+  uint32_t *heap_pages[TLB_BENCH_PAGES];
+  uint8_t *heap = get_kernel_pages(TLB_BENCH_PAGES);
+  uint32_t idx;
+  if (heap == NULL) {
+    printk("tlb_bench: get_kernel_pages failed\n");
+    return;
+  }
+  for (idx = 0; idx < TLB_BENCH_PAGES; idx++) {
+    /* spread over the low 1MB, which holds the kernel image */
+    image_pages[idx] = (uint32_t *)(0xc0000000 + idx * 0x4000);
+    heap_pages[idx] = (uint32_t *)(heap + idx * PAGE_SIZE);
+  }
+
+  enum intr_status old_status = intr_disable();
+  pte_t *kernel_pde = pde_ptr(0xc0000000);
+  uint32_t cr4 = cr4_read();
+
+  /* before: 4KB pages and no global pages  */
+  *kernel_pde = (LOW_1M_PT_PHY_ADDR | PG_US_U | PG_RW_W | PG_P_1);
+  cr4_write(cr4 & ~CR4_PGE);
+  uint32_t image_4k = tlb_walk(image_pages, TLB_BENCH_PAGES);
+  uint32_t heap_4k = tlb_walk(heap_pages, TLB_BENCH_PAGES);
+
+  /* after: 4MB global page for the image, global PTEs for the heap */
+  *kernel_pde = KERNEL_PDE_4M;
+  cr4_write(cr4 | CR4_PGE);
+  uint32_t image_4m = tlb_walk(image_pages, TLB_BENCH_PAGES);
+  uint32_t heap_global = tlb_walk(heap_pages, TLB_BENCH_PAGES);
+  intr_set_status(old_status);
+
+  printk("tlb_bench: cycles per CR3 reload + %d page reads\n", TLB_BENCH_PAGES);
+  printk("  kernel image: 4KB %d, 4MB global %d\n", image_4k, image_4m);
+  printk("  kernel heap:  4KB %d, 4KB global %d\n", heap_4k, heap_global);
+  free_kernel_pages(heap, TLB_BENCH_PAGES);
+}
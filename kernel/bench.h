@@ -0,0 +1,9 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-22
+ */
+
+#ifndef __KERNEL_BENCH_H
+#define __KERNEL_BENCH_H
+void tlb_bench(void);
+#endif
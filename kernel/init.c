@@ -11,6 +11,8 @@
 #include "keyboard.h"
 #include "memory.h"
 #include "print.h"
+#include "shm.h"
+#include "swap.h"
 #include "syscall_init.h"
 #include "thread.h"
 #include "timer.h"
@@ -29,6 +31,8 @@ void init_all() {
   keyboard_init();
   tss_init();
   syscall_init();
+  shm_init();
   ide_init();
+  swap_init();
   filesys_init();
 }
@@ -2,6 +2,7 @@
  * Author: Zhang Xun
  * Time: 2023-11-29
  */
+#include "bench.h"
 #include "console.h"
 #include "debug.h"
 #include "dir.h"
@@ -37,6 +38,10 @@ int main() {
   put_str("I am kernel\n");
   init_all();
 
+#ifdef BENCH
+  tlb_bench();
+#endif
+
   uint32_t file_size = 22624;
   uint32_t sector_cnt = DIV_ROUND_UP(file_size, SECTOR_SIZE);
 
@@ -45,7 +50,7 @@ int main() {
 
   /* read the user process into prog_buf  */
   void *prog_buf = sys_malloc(file_size);
-  ide_read(sda, 300, prog_buf, sector_cnt);
+  ide_read(sda, 400, prog_buf, sector_cnt);
 
   int32_t fd = sys_open("/prog_no_arg", O_CREAT | O_RDWR);
   if (fd != -1) {
@@ -3,42 +3,134 @@
  * Time: 2023-11-30
  */
 #include "memory.h"
+#include "alloc_trace.h"
 #include "bitmap.h"
 #include "debug.h"
+#include "file.h"
+#include "fs.h"
 #include "global.h"
 #include "interrupt.h"
 #include "list.h"
+#include "page_cache.h"
 #include "print.h"
+#include "process.h"
+#include "slab.h"
 #include "stdint.h"
+#include "stdio.h"
 #include "string.h"
+#include "swap.h"
 #include "sync.h"
 #include "thread.h"
-
-/* virtual address for kernel bitmap  */
-#define MEM_BITMAP_BASE 0xc009a000
-
-/* The kernel's virtual address starts from 3G and needs to spans the beginning
- * and used 1MB, that is, 0xc0000000 + 0x00100000= 0xc0100000*/
-#define KERNEL_HEAP_START 0xc0100000
+#include "userprog.h"
+#include "vma.h"
+
+/* the e820 map saved by loader.S: ARDS_buf at 0xb0a and ARDS_num at 0xbfe */
+#define ARDS_BUF_ADDR 0xc0000b0a
+#define ARDS_NUM_ADDR 0xc0000bfe
+#define ARDS_MAX_NUM 12
+/* type of an e820 range that is usable RAM */
+#define E820_RAM 1
+
+/* percentage of usable frames given to kernel_pool, the rest is user_pool.
+ * Override with 'make KERNEL_POOL_PERCENT=n' */
+#ifndef KERNEL_POOL_PERCENT
+#define KERNEL_POOL_PERCENT 50
+#endif
+
+/* The kernel's virtual address starts from 3G and needs to span the first 4MB,
+ * which the loader maps with a single 4MB page (PDE 768), or two 2MB pages
+ * with PAE, that is, 0xc0000000 + 0x00400000 = 0xc0400000 */
+#define KERNEL_HEAP_START 0xc0400000
+
+#ifdef PAE
+/* PDE 508-511 of PD 3 point to the four page directories themselves */
+#define KERNEL_HEAP_END 0xff800000
+/* the PDEs of the four page directories are indexed as one array */
+#define PDE_IDX(addr) ((addr) >> 21)
+#define PTE_IDX(addr) ((addr & 0x001ff000) >> 12)
+/* the PDPT, 4 PDs, 1 PT of the low 1MB and 506 PTs of the kernel, built by
+ * setup_page in loader.S */
+#define PAGE_TABLES_SIZE (PAGE_SIZE * 512)
+/* frames are usable up to 64GB, above that their descriptors would not fit
+ * in the kernel heap */
+#define PHY_ADDR_END 0x1000000000ULL
+#else
+/* PDE 1023 points to the page directory itself */
+#define KERNEL_HEAP_END 0xffc00000
 
 #define PDE_IDX(addr) ((addr & 0xffc00000) >> 22)
 #define PTE_IDX(addr) ((addr & 0x003ff000) >> 12)
+/* 1 PDT + 255 PTs = 4KB*256=1024KB=1MB (0x100000B) */
+#define PAGE_TABLES_SIZE (PAGE_SIZE * 256)
+/* the last page below 4GB is left out, so the end of RAM fits in 32 bits */
+#define PHY_ADDR_END 0xfffff000
+#endif
+
+/* largest buddy block is 2^BUDDY_MAX_ORDER pages, that is, 4MB */
+#define BUDDY_MAX_ORDER 10
+
+/* number of pre-zeroed page frames the idle thread keeps in each pool */
+#define ZEROED_PAGES_TARGET 32
+
+/* number of kernel virtual pages kmap() hands out */
+#define KMAP_SLOTS 8
+
+/**
+ * struct page - Descriptor of a physical page frame.
+ * @buddy_tag: Element in the free_area list of the owning pool while this
+ * frame heads a free buddy block, or in its zeroed_pages list while this frame
+ * waits there already zeroed.
+ * @order: Order of the free buddy block headed by this frame.
+ * @free: Non-zero if this frame heads a free buddy block.
+ * @share_cnt: Number of extra page tables that map this frame copy-on-write
+ * after fork, pfree() only drops one of them while it is non-zero.
+ * @owner: The process mapping this user frame, if it is its only mapping and
+ * the frame may be swapped out, NULL otherwise.
+ * @vaddr: The user virtual address 'owner' maps the frame at.
+ *
+ * Every page frame of kernel_pool and user_pool has one descriptor. Only the
+ * first frame of a free block is marked, the remaining frames of that block
+ * keep free == 0, so that a buddy can be recognized in O(1) during coalescing.
+ * The owner is the reverse mapping page_reclaim() needs to find the PTE of a
+ * frame. Frames shared by several page tables (copy-on-write, shared memory,
+ * page cache, the zero page) have none and stay in memory.
+ */
+struct page {
+  struct list_elem buddy_tag;
+  uint8_t order;
+  uint8_t free;
+  uint16_t share_cnt;
+  struct task_struct *owner;
+  uint32_t vaddr;
+};
 
 /**
  * struct pool - Represents a physical memory pool.
- * @pool_bitmap: Bitmap to track the allocation status of pages in the pool.
+ * @pages: Array of page frame descriptors, one for each frame in the pool.
+ * @page_cnt: The number of page frames in the pool.
+ * @free_area: Free lists of the buddy allocator, free_area[k] links the free
+ * blocks of 2^k contiguous page frames.
+ * @zeroed_pages: Page frames taken out of the buddy allocator and zeroed by
+ * the idle thread in advance.
+ * @zeroed_cnt: The number of page frames in 'zeroed_pages'.
+ * @free_cnt: The number of page frames in the buddy allocator.
  * @phy_addr_start: The starting physical address of the memory pool.
- * @pool_size: The total size of the memory pool.
+ * @pool_size: The size of the usable memory (holes excluded) in the pool.
  *
  * This structure is used to manage a physical memory pool, either for the
- * kernel or user space. It includes a bitmap to efficiently track which
- * pages are free or allocated, as well as the starting address and total
- * size of the memory pool.
+ * kernel or user space. Page frames are handed out by a binary buddy
+ * allocator, so that a request for 2^k pages is served from a physically
+ * contiguous block in O(log n) and freed blocks are merged with their buddies.
  */
 struct pool {
-  struct bitmap pool_bitmap;
-  uint32_t phy_addr_start;
-  uint32_t pool_size;
+  struct page *pages;
+  uint32_t page_cnt;
+  struct list free_area[BUDDY_MAX_ORDER + 1];
+  struct list zeroed_pages;
+  uint32_t zeroed_cnt;
+  uint32_t free_cnt;
+  phys_addr_t phy_addr_start;
+  phys_addr_t pool_size;
   struct lock _lock;
 };
 
@@ -47,6 +139,59 @@ struct pool kernel_pool, user_pool;
 /* virtual memory pool of kernel */
 struct virtual_addr kernel_vaddr;
 
+/**
+ * struct ards - Address Range Descriptor Structure returned by BIOS e820.
+ * @base_low, @base_high: The base address of the range.
+ * @length_low, @length_high: The length of the range in bytes.
+ * @type: E820_RAM if the range is usable, anything else is reserved.
+ */
+struct ards {
+  uint32_t base_low;
+  uint32_t base_high;
+  uint32_t length_low;
+  uint32_t length_high;
+  uint32_t type;
+};
+
+/**
+ * struct mem_range - A range of usable physical memory, page aligned.
+ * @start: The first byte of the range.
+ * @end: The byte after the range.
+ */
+struct mem_range {
+  phys_addr_t start;
+  phys_addr_t end;
+};
+
+/* usable RAM above the memory used by the kernel, sorted by address */
+static struct mem_range ram_ranges[ARDS_MAX_NUM];
+static uint32_t ram_range_cnt;
+
+/* the first of the KMAP_SLOTS kernel virtual pages kmap() maps frames at */
+static uint32_t kmap_base;
+/* the frame each slot maps or last mapped, and whether it is in use */
+static phys_addr_t kmap_phy_addr[KMAP_SLOTS];
+static bool kmap_busy[KMAP_SLOTS];
+/* serializes the users of the clock hand, and makes a fault on a page
+ * being written to swap wait until it can be read back */
+static struct lock swap_lock;
+/* the next frame of user_pool page_reclaim() looks at */
+static uint32_t clock_hand;
+/* kernel page an evicted frame is copied to before swap_write() blocks, so
+ * no kmap() slot is held across the disk, guarded by swap_lock */
+static void *swap_bounce;
+
+/* frame mapped read-only wherever anonymous user memory is not written yet */
+static phys_addr_t zero_page_phy;
+/* number of user PTEs mapping the zero page, each saves a page frame */
+uint32_t zero_page_saved;
+
+#ifdef PAE
+/* PG_NX if the CPU supports it, set in the PTEs of user pages outside
+ * VM_EXEC regions */
+static pte_t pg_nx;
+#endif
+
 /**
  * struct arena - Metadata for memory storage arena.
  * @desc: Pointer to the associated memory block descriptor.
@@ -72,19 +217,148 @@ struct arena {
 };
 
 struct mem_block_desc k_mb_desc_arr[MB_DESC_CNT];
+extern struct list thread_all_list;
+
+static void page_table_add(void *_vaddr, phys_addr_t page_phy_addr);
+static void page_owner_set(phys_addr_t page_phy_addr, uint32_t vaddr);
+static void page_fault_handler(uint8_t vec_nr);
+static void zero_page_init(void);
+
+/**
+ * buddy_free_range() - Put a range of page frames into the buddy free lists.
+ * @m_pool: The memory pool.
+ * @pg_idx: The index of the first frame of the range in the pool.
+ * @pg_end: The index after the last frame of the range.
+ *
+ * The range is carved from 'pg_idx' upward into the largest blocks that are
+ * naturally aligned (relative to the start of the pool) and fit into the
+ * remaining frames, so that a range whose size is not a power of two is
+ * still fully usable.
+ */
+static void buddy_free_range(struct pool *m_pool, uint32_t pg_idx,
+                             uint32_t pg_end) {
+  uint8_t order;
+  while (pg_idx < pg_end) {
+    order = BUDDY_MAX_ORDER;
+    while ((pg_idx & ((1 << order) - 1)) || (pg_idx + (1 << order) > pg_end)) {
+      order--;
+    }
+    m_pool->pages[pg_idx].order = order;
+    m_pool->pages[pg_idx].free = 1;
+    list_append(&m_pool->free_area[order], &m_pool->pages[pg_idx].buddy_tag);
+    m_pool->free_cnt += 1 << order;
+    pg_idx += 1 << order;
+  }
+}
+
+/**
+ * buddy_init() - Put the usable page frames of a pool into the buddy lists.
+ * @m_pool: The memory pool whose 'pages' and 'page_cnt' are already set.
+ *
+ * Only the frames inside ram_ranges are freed. Frames in holes and reserved
+ * ranges keep a descriptor, but are never handed out. Return the number of
+ * usable frames of the pool.
+ */
+static uint32_t buddy_init(struct pool *m_pool) {
+  uint8_t order;
+  for (order = 0; order <= BUDDY_MAX_ORDER; order++) {
+    list_init(&m_pool->free_area[order]);
+  }
+  list_init(&m_pool->zeroed_pages);
+  m_pool->zeroed_cnt = 0;
+  m_pool->free_cnt = 0;
+  memset(m_pool->pages, 0, m_pool->page_cnt * sizeof(struct page));
+
+  phys_addr_t pool_start = m_pool->phy_addr_start;
+  phys_addr_t pool_end = pool_start + (phys_addr_t)m_pool->page_cnt * PAGE_SIZE;
+  uint32_t usable_cnt = 0;
+  uint32_t range_idx;
+  for (range_idx = 0; range_idx < ram_range_cnt; range_idx++) {
+    phys_addr_t start = ram_ranges[range_idx].start;
+    phys_addr_t end = ram_ranges[range_idx].end;
+    if (start < pool_start)
+      start = pool_start;
+    if (end > pool_end)
+      end = pool_end;
+    if (start >= end)
+      continue;
+    buddy_free_range(m_pool, (start - pool_start) / PAGE_SIZE,
+                     (end - pool_start) / PAGE_SIZE);
+    usable_cnt += (end - start) / PAGE_SIZE;
+  }
+  return usable_cnt;
+}
+
+/**
+ * ram_ranges_init() - Collect the usable RAM from the e820 map.
+ * @all_mem: Total memory size computed by the loader, only used when the
+ * BIOS does not support e820.
+ * @used_mem: Physical memory below this address is used by the kernel.
+ *
+ * Ranges of type E820_RAM are trimmed to whole pages, clipped to
+ * [used_mem, PHY_ADDR_END) and sorted by address, everything else (reserved,
+ * ACPI, holes) is left out. Without PAE that is everything above 4GB.
+ */
+static void ram_ranges_init(uint32_t all_mem, uint32_t used_mem) {
+  struct ards *ards = (struct ards *)ARDS_BUF_ADDR;
+  uint16_t ards_num = *(uint16_t *)ARDS_NUM_ADDR;
+  struct ards fallback = {0, 0, all_mem, 0, E820_RAM};
+  if (ards_num == 0) {
+    ards = &fallback;
+    ards_num = 1;
+  }
+  ASSERT(ards_num <= ARDS_MAX_NUM);
+
+  ram_range_cnt = 0;
+  uint32_t ards_idx;
+  for (ards_idx = 0; ards_idx < ards_num; ards_idx++) {
+    if (ards[ards_idx].type != E820_RAM)
+      continue;
+    uint64_t base = ((uint64_t)ards[ards_idx].base_high << 32) |
+                    ards[ards_idx].base_low;
+    uint64_t end = base + (((uint64_t)ards[ards_idx].length_high << 32) |
+                           ards[ards_idx].length_low);
+    if (end > PHY_ADDR_END)
+      end = PHY_ADDR_END;
+    if (base >= end)
+      continue;
+
+    phys_addr_t start = (base + PAGE_SIZE - 1) & PG_FRAME;
+    phys_addr_t range_end = end & PG_FRAME;
+    if (start < used_mem)
+      start = used_mem;
+    if (start >= range_end)
+      continue;
+
+    /* insertion sort by start address */
+    uint32_t pos = ram_range_cnt++;
+    while (pos > 0 && ram_ranges[pos - 1].start > start) {
+      ram_ranges[pos] = ram_ranges[pos - 1];
+      pos--;
+    }
+    ram_ranges[pos].start = start;
+    ram_ranges[pos].end = range_end;
+  }
+  ASSERT(ram_range_cnt > 0);
+}
 
 /**
  * mem_pool_init() - Initializes the physical and virtual memory pools for
  * kernel and user.
- * @all_mem: The total physical memory size.
+ * @all_mem: The total physical memory size computed by the loader.
  *
- * This function initializes memory pools for both the kernel and user.
- * It calculates and divides the available memory between the kernel and user
- * space, accounting for the memory already used by the kernel. It initializes
- * the bitmaps for these pools to keep track of free and used pages. The
- * function also sets up the starting addresses and sizes for the kernel and
- * user memory pools. Additionally, it initializes the virtual address pool for
- * the kernel.
+ * This function initializes memory pools for both the kernel and user from
+ * the e820 map. The frames above the memory already used by the kernel are
+ * split into two contiguous physical ranges: kernel_pool takes the lower part,
+ * holding KERNEL_POOL_PERCENT percent of the usable frames (as long as the
+ * kernel heap can map them all), user_pool takes the rest. Holes and reserved
+ * ranges stay inside the pools but are never handed out.
+ *
+ * The metadata is sized at run time and carved from the first frames of the
+ * kernel pool, then mapped at the start of the kernel heap: the page frame
+ * descriptors of both pools, followed by the bitmap of the kernel virtual
+ * address pool and its summary. Then each pool hands its usable frames to the
+ * buddy allocator.
  *
  * Context: This function should be called during system initialization to set
  * up memory pools for the kernel and user space.
@@ -94,58 +368,108 @@ static void mem_pool_init(uint32_t all_mem) {
   lock_init(&kernel_pool._lock);
   lock_init(&user_pool._lock);
 
-  /* 1 PDT + 255 PTs = 4KB*256=1024KB=1MB (0x100000B) */
-  uint32_t page_table_size = PAGE_SIZE * 256;
+  uint32_t page_table_size = PAGE_TABLES_SIZE;
 
   /* 0x100000 is the low 1MB physical space used by the kernel */
-  /* so the value of used_mem = 2MB (0x200000)*/
+  /* so the value of used_mem = 2MB (0x200000), 3MB with PAE */
   uint32_t used_mem = page_table_size + 0x100000;
-  uint32_t free_mem = all_mem - used_mem;
-
-  /* ignore physical memory smaller than PAGE_SIZE */
-  uint16_t all_free_pages = free_mem / PAGE_SIZE;
-
-  uint16_t kernel_free_pages = all_free_pages / 2;
-  uint16_t user_free_pages = all_free_pages - kernel_free_pages;
-
-  uint32_t kernel_bitmap_len = kernel_free_pages / 8;
-  uint32_t user_bitmap_len = user_free_pages / 8;
+  ram_ranges_init(all_mem, used_mem);
+
+  /* the metadata is carved from the first frames, which must be RAM */
+  ASSERT(ram_ranges[0].start == used_mem);
+  phys_addr_t mem_top = ram_ranges[ram_range_cnt - 1].end;
+  uint32_t all_pages = (mem_top - used_mem) / PAGE_SIZE;
+  uint32_t usable_pages = 0;
+  uint32_t range_idx;
+  for (range_idx = 0; range_idx < ram_range_cnt; range_idx++) {
+    usable_pages +=
+        (ram_ranges[range_idx].end - ram_ranges[range_idx].start) / PAGE_SIZE;
+  }
 
-  uint32_t kernel_pool_start = used_mem;
-  uint32_t user_pool_start = kernel_pool_start + kernel_free_pages * PAGE_SIZE;
+  /* find the end of kernel pool: it covers the wanted number of usable
+   * frames, but never more frames than the kernel heap can map */
+  uint32_t kernel_usable_goal = usable_pages / 100 * KERNEL_POOL_PERCENT;
+  uint32_t kernel_span_max = (KERNEL_HEAP_END - KERNEL_HEAP_START) / PAGE_SIZE;
+  phys_addr_t kernel_end = used_mem;
+  uint32_t kernel_usable = 0;
+  for (range_idx = 0; range_idx < ram_range_cnt; range_idx++) {
+    phys_addr_t start = ram_ranges[range_idx].start;
+    uint32_t span_before = (start - used_mem) / PAGE_SIZE;
+    if (span_before >= kernel_span_max)
+      break;
+    uint32_t pg_cnt = (ram_ranges[range_idx].end - start) / PAGE_SIZE;
+    if (pg_cnt > kernel_usable_goal - kernel_usable)
+      pg_cnt = kernel_usable_goal - kernel_usable;
+    if (span_before + pg_cnt > kernel_span_max)
+      pg_cnt = kernel_span_max - span_before;
+    kernel_end = start + (phys_addr_t)pg_cnt * PAGE_SIZE;
+    kernel_usable += pg_cnt;
+    if (kernel_usable == kernel_usable_goal ||
+        span_before + pg_cnt == kernel_span_max)
+      break;
+  }
+  uint32_t kernel_span = (kernel_end - used_mem) / PAGE_SIZE;
+
+  /* page frame descriptors of both pools, then the kernel vaddr bitmap with
+   * its summary, all carved from the kernel pool */
+  uint32_t page_desc_len = all_pages * sizeof(struct page);
+  uint32_t kernel_bitmap_len = DIV_ROUND_UP(kernel_span, 8);
+  uint32_t meta_pg_cnt =
+      DIV_ROUND_UP(page_desc_len + kernel_bitmap_len +
+                       BITMAP_SUMMARY_BYTES(kernel_bitmap_len),
+                   PAGE_SIZE);
+  ASSERT(ram_ranges[0].end >= used_mem + meta_pg_cnt * PAGE_SIZE &&
+         kernel_span > meta_pg_cnt);
+
+  kernel_pool.phy_addr_start = used_mem + meta_pg_cnt * PAGE_SIZE;
+  kernel_pool.page_cnt = kernel_span - meta_pg_cnt;
+
+  user_pool.phy_addr_start = kernel_end;
+  user_pool.page_cnt = (mem_top - kernel_end) / PAGE_SIZE;
+
+  /* map the metadata at the beginning of kernel heap. The PDE of kernel space
+   * is created by loader, so no page table is allocated here */
+  uint32_t pg_idx;
+  for (pg_idx = 0; pg_idx < meta_pg_cnt; pg_idx++) {
+    page_table_add((void *)(KERNEL_HEAP_START + pg_idx * PAGE_SIZE),
+                   used_mem + pg_idx * PAGE_SIZE);
+  }
+  kernel_pool.pages = (struct page *)KERNEL_HEAP_START;
+  user_pool.pages = kernel_pool.pages + kernel_pool.page_cnt;
 
-  kernel_pool.phy_addr_start = kernel_pool_start;
-  kernel_pool.pool_size = kernel_free_pages * PAGE_SIZE;
-  kernel_pool.pool_bitmap.bmap_bytes_len = kernel_bitmap_len;
+  kernel_vaddr.vaddr_bitmap.bmap_bytes_len = kernel_bitmap_len;
+  kernel_vaddr.vaddr_bitmap.bits = (void *)(KERNEL_HEAP_START + page_desc_len);
+  kernel_vaddr.vaddr_start = KERNEL_HEAP_START;
+  bitmap_init(&kernel_vaddr.vaddr_bitmap);
+  /* the summary level of kernel vaddr bitmap follows the bitmap itself */
+  bitmap_summary_init(
+      &kernel_vaddr.vaddr_bitmap,
+      (uint32_t *)(KERNEL_HEAP_START + page_desc_len + kernel_bitmap_len));
+  for (pg_idx = 0; pg_idx < meta_pg_cnt; pg_idx++) {
+    bitmap_set(&kernel_vaddr.vaddr_bitmap, pg_idx, 1);
+  }
 
-  user_pool.phy_addr_start = user_pool_start;
-  user_pool.pool_size = user_free_pages * PAGE_SIZE;
-  user_pool.pool_bitmap.bmap_bytes_len = user_bitmap_len;
+  /* the virtual pages next to the metadata are the kmap slots, their PTEs
+   * are filled by kmap() */
+  for (pg_idx = 0; pg_idx < KMAP_SLOTS; pg_idx++) {
+    bitmap_set(&kernel_vaddr.vaddr_bitmap, meta_pg_cnt + pg_idx, 1);
+  }
+  kmap_base = KERNEL_HEAP_START + meta_pg_cnt * PAGE_SIZE;
 
-  kernel_pool.pool_bitmap.bits = (void *)MEM_BITMAP_BASE;
-  user_pool.pool_bitmap.bits = (void *)(MEM_BITMAP_BASE + kernel_bitmap_len);
+  kernel_pool.pool_size = (phys_addr_t)buddy_init(&kernel_pool) * PAGE_SIZE;
+  user_pool.pool_size = (phys_addr_t)buddy_init(&user_pool) * PAGE_SIZE;
 
-  put_str("    kernel_pool_bitmap_start:");
-  put_int((int)kernel_pool.pool_bitmap.bits);
+  put_str("    kernel_pool_pages:");
+  put_int((int)kernel_pool.page_cnt);
   put_str(" kernel_pool_phy_start:");
   put_int(kernel_pool.phy_addr_start);
   put_str("\n");
 
-  put_str("    user_pool_bitmap_start:");
-  put_int((int)user_pool.pool_bitmap.bits);
+  put_str("    user_pool_pages:");
+  put_int((int)user_pool.page_cnt);
   put_str(" user_pool_phy_start:");
   put_int(user_pool.phy_addr_start);
   put_str("\n");
-
-  bitmap_init(&kernel_pool.pool_bitmap);
-  bitmap_init(&user_pool.pool_bitmap);
-
-  kernel_vaddr.vaddr_bitmap.bmap_bytes_len = kernel_bitmap_len;
-  kernel_vaddr.vaddr_bitmap.bits =
-      (void *)(MEM_BITMAP_BASE + kernel_bitmap_len + user_bitmap_len);
-
-  kernel_vaddr.vaddr_start = KERNEL_HEAP_START;
-  bitmap_init(&kernel_vaddr.vaddr_bitmap);
   put_str("  mem_pool_init done\n");
 }
 
@@ -169,10 +493,44 @@ void block_desc_init(struct mem_block_desc *k_mb_desc_arr) {
     k_mb_desc_arr[desc_idx].block_per_arena =
         (PAGE_SIZE - sizeof(struct arena)) / _block_size;
     list_init(&k_mb_desc_arr[desc_idx].free_list);
+    k_mb_desc_arr[desc_idx].arena_cnt = 0;
     _block_size *= 2;
   }
 }
 
+#ifdef PAE
+/* CPUID 0x80000001: EDX bit 20, the NX bit is supported */
+#define CPUID_EDX_NX 0x100000
+#define MSR_EFER 0xc0000080
+#define EFER_NXE 0x800
+
+/**
+ * nx_init() - Enable the NX bit if the CPU has it.
+ *
+ * PG_NX is a reserved bit until EFER.NXE is set, so it is only put in PTEs
+ * (through pg_nx) once this succeeds.
+ */
+static void nx_init(void) {
+  uint32_t eax, ebx, ecx, edx;
+  asm volatile("cpuid"
+               : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+               : "a"(0x80000000));
+  if (eax < 0x80000001)
+    return;
+  asm volatile("cpuid"
+               : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+               : "a"(0x80000001));
+  if (!(edx & CPUID_EDX_NX))
+    return;
+  asm volatile("rdmsr; orl %1, %%eax; wrmsr"
+               :
+               : "c"(MSR_EFER), "i"(EFER_NXE)
+               : "eax", "edx");
+  pg_nx = PG_NX;
+  put_str("  NX enabled\n");
+}
+#endif
+
 /**
  * mem_init() - Entry point for memory management initialization.
  *
@@ -180,7 +538,8 @@ void block_desc_init(struct mem_block_desc *k_mb_desc_arr) {
  * message to indicate the start of memory initialization. It then reads the
  * total memory size and initializes the memory pool with this size. Finally,
  * it initializes the array of memory block descriptors, which is essential for
- * the malloc function, and prints a completion message.
+ * the malloc function, and the list of object caches, and prints a completion
+ * message.
  *
  * Context: This function is crucial for setting up the memory management
  * system. It initializes the memory pool and prepares the memory block
@@ -190,8 +549,20 @@ void block_desc_init(struct mem_block_desc *k_mb_desc_arr) {
 void mem_init() {
   put_str("mem_init start\n");
   uint32_t mem_bytes_total = (*(uint32_t *)(0xb00));
+#ifdef PAE
+  nx_init();
+#endif
   mem_pool_init(mem_bytes_total);
+  zero_page_init();
   block_desc_init(k_mb_desc_arr);
+  slab_init();
+  vma_init();
+  lock_init(&swap_lock);
+  register_handler(0x0e, page_fault_handler);
+  /* set CR0.WP, so that writes of the kernel to read-only user pages fault as
+   * well and never go through a copy-on-write page */
+  asm volatile("movl %%cr0, %%eax; orl $0x10000, %%eax; movl %%eax, %%cr0" ::
+                   : "eax");
   put_str("mem_init done\n");
 }
 
@@ -218,16 +589,9 @@ static void *vaddr_get(enum pool_flags pf, uint32_t pg_cnt) {
   } else {
     /* for user process*/
     struct task_struct *cur = running_thread();
-    free_bit_idx_start = bitmap_scan(&cur->userprog_vaddr.vaddr_bitmap, pg_cnt);
-    if (free_bit_idx_start == -1)
+    vaddr_start = vma_alloc(cur, pg_cnt * PAGE_SIZE, VM_READ | VM_WRITE);
+    if (vaddr_start == 0)
       return NULL;
-    while (cnt < pg_cnt) {
-      bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, free_bit_idx_start + cnt++,
-                 1);
-    }
-    vaddr_start =
-        cur->userprog_vaddr.vaddr_start + free_bit_idx_start * PAGE_SIZE;
-    ASSERT((uint32_t)vaddr_start < (0xc0000000 - PAGE_SIZE));
   }
   return (void *)vaddr_start;
 }
@@ -243,14 +607,20 @@ static void *vaddr_get(enum pool_flags pf, uint32_t pg_cnt) {
  * entry in the page (The high 10 bits of vaddr should be 1 to access this PDE)
  * directory to access the page directory itself, thus enabling the calculation
  * of the virtual address that can be used to access the appropriate PTE within
- * the pageable. See Page.391 for details.
+ * the pageable. See Page.391 for details. With PAE, PDE 508-511 of the
+ * kernel page directory point to the four page directories, so all page
+ * tables appear as one array of 64-bit PTEs from 0xff800000.
  *
  * Return: The virtual address of the page table entry corresponding to the
  * given virtual address.
  */
-uint32_t *pte_ptr(uint32_t vaddr) {
-  uint32_t *pte = (uint32_t *)(0xffc00000 + ((vaddr & 0xffc00000) >> 10) +
-                               PTE_IDX(vaddr) * 4);
+pte_t *pte_ptr(uint32_t vaddr) {
+#ifdef PAE
+  pte_t *pte = (pte_t *)(0xff800000 + (vaddr >> 12) * sizeof(pte_t));
+#else
+  pte_t *pte = (pte_t *)(0xffc00000 + ((vaddr & 0xffc00000) >> 10) +
+                         PTE_IDX(vaddr) * 4);
+#endif
   return pte;
 }
 
@@ -267,34 +637,331 @@ uint32_t *pte_ptr(uint32_t vaddr) {
  * PDE. The calculation is done by starting from a fixed high memory location
  * (0xfffff000) which represents the starting address of PDE and applying an
  * offset based on the `vaddr` to reach the specific PDE. See Page.392 for
- * details.
+ * details. With PAE, the four page directories follow each other from
+ * 0xffffc000.
  *
  * Return: The virtual address of the page directory entry corresponding to the
  * given virtual address.
  */
-uint32_t *pde_ptr(uint32_t vaddr) {
-  uint32_t *pde = (uint32_t *)((0xfffff000) + PDE_IDX(vaddr) * 4);
+pte_t *pde_ptr(uint32_t vaddr) {
+#ifdef PAE
+  pte_t *pde = (pte_t *)(0xffffc000 + PDE_IDX(vaddr) * sizeof(pte_t));
+#else
+  pte_t *pde = (pte_t *)((0xfffff000) + PDE_IDX(vaddr) * 4);
+#endif
   return pde;
 }
 
+/**
+ * buddy_alloc - Takes a free block of 2^order page frames out of a pool.
+ * @m_pool: The memory pool to allocate from.
+ * @order: The order of the block.
+ *
+ * The smallest free block whose order is not less than 'order' is taken from
+ * the free lists. If it is larger than required, it is split in halves, and
+ * the upper halves are put back to the free lists of the lower orders.
+ *
+ * Return: The index of the first page frame of the block in the pool, or -1 if
+ * there is no free block large enough.
+ */
+static int32_t buddy_alloc(struct pool *m_pool, uint8_t order) {
+  enum intr_status old_status = intr_disable();
+  uint8_t cur_order = order;
+  while (cur_order <= BUDDY_MAX_ORDER &&
+         list_empty(&m_pool->free_area[cur_order])) {
+    cur_order++;
+  }
+  if (cur_order > BUDDY_MAX_ORDER) {
+    intr_set_status(old_status);
+    return -1;
+  }
+
+  struct page *pg = elem2entry(struct page, buddy_tag,
+                               list_pop(&m_pool->free_area[cur_order]));
+  pg->free = 0;
+  m_pool->free_cnt -= 1 << order;
+  int32_t pg_idx = pg - m_pool->pages;
+
+  /* split the block until it matches the requested order */
+  while (cur_order > order) {
+    cur_order--;
+    struct page *upper_half = &m_pool->pages[pg_idx + (1 << cur_order)];
+    upper_half->order = cur_order;
+    upper_half->free = 1;
+    list_push(&m_pool->free_area[cur_order], &upper_half->buddy_tag);
+  }
+  intr_set_status(old_status);
+  return pg_idx;
+}
+
+/**
+ * buddy_free - Gives a block of 2^order page frames back to a pool.
+ * @m_pool: The memory pool the block belongs to.
+ * @pg_idx: The index of the first page frame of the block in the pool.
+ * @order: The order of the block.
+ *
+ * As long as the buddy of the block is a free block of the same order, the two
+ * are merged into a block of the next order. The merged block is then put into
+ * the corresponding free list.
+ */
+static void buddy_free(struct pool *m_pool, uint32_t pg_idx, uint8_t order) {
+  enum intr_status old_status = intr_disable();
+  m_pool->free_cnt += 1 << order;
+  while (order < BUDDY_MAX_ORDER) {
+    uint32_t buddy_idx = pg_idx ^ (1 << order);
+    if (buddy_idx + (1 << order) > m_pool->page_cnt)
+      break;
+    struct page *buddy = &m_pool->pages[buddy_idx];
+    if (!buddy->free || buddy->order != order)
+      break;
+    list_remove(&buddy->buddy_tag);
+    buddy->free = 0;
+    /* the merged block starts from the lower one of the two buddies */
+    pg_idx &= ~(1 << order);
+    order++;
+  }
+  m_pool->pages[pg_idx].order = order;
+  m_pool->pages[pg_idx].free = 1;
+  list_push(&m_pool->free_area[order], &m_pool->pages[pg_idx].buddy_tag);
+  intr_set_status(old_status);
+}
+
+/* physical address of the frame at pg_idx in a pool  */
+static phys_addr_t pool_frame_phy(struct pool *m_pool, uint32_t pg_idx) {
+  return m_pool->phy_addr_start + (phys_addr_t)pg_idx * PAGE_SIZE;
+}
+
+/* the smallest order whose block can hold pg_cnt pages  */
+static uint8_t pg_cnt_to_order(uint32_t pg_cnt) {
+  uint8_t order = 0;
+  while ((1U << order) < pg_cnt) {
+    order++;
+  }
+  return order;
+}
+
+/**
+ * palloc_pages - Allocates physically contiguous pages from a memory pool.
+ * @m_pool: A pointer to the memory pool from which to allocate the pages.
+ * @pg_cnt: The number of pages, no more than 2^BUDDY_MAX_ORDER.
+ *
+ * A buddy block large enough for 'pg_cnt' pages is allocated, and the page
+ * frames beyond 'pg_cnt' at its end are given back to the pool immediately.
+ * Each of the allocated frames can later be released alone by pfree().
+ *
+ * Return: The physical address of the first page, or 0 if there is no such
+ * contiguous space in the pool.
+ */
+static phys_addr_t palloc_pages(struct pool *m_pool, uint32_t pg_cnt) {
+  ASSERT(pg_cnt > 0 && pg_cnt <= (1 << BUDDY_MAX_ORDER));
+  uint8_t order = pg_cnt_to_order(pg_cnt);
+  int32_t pg_idx = buddy_alloc(m_pool, order);
+  if (pg_idx == -1)
+    return 0;
+
+  /* return the unused tail as naturally aligned blocks */
+  uint32_t tail_idx = pg_idx + pg_cnt;
+  uint32_t block_end = pg_idx + (1 << order);
+  while (tail_idx < block_end) {
+    uint8_t tail_order = 0;
+    while (!(tail_idx & (1 << tail_order)) &&
+           tail_idx + (2 << tail_order) <= block_end) {
+      tail_order++;
+    }
+    buddy_free(m_pool, tail_idx, tail_order);
+    tail_idx += 1 << tail_order;
+  }
+  return pool_frame_phy(m_pool, pg_idx);
+}
+
+/* drop the TLB entry of vaddr  */
+static inline void tlb_flush_page(uint32_t vaddr) {
+  asm volatile("invlpg %0" ::"m"(*(uint8_t *)vaddr) : "memory");
+}
+
+/**
+ * kmap - Maps any page frame in kernel space for a short while.
+ * @page_phy_addr: The physical address of the frame.
+ *
+ * The kernel only sees a frame through the page tables of the running task,
+ * this gives it a kernel virtual page mapping the frame, valid in every
+ * address space. A slot that still maps the same frame is reused without
+ * touching the TLB, so mapping the same page table over and over is cheap.
+ * A slot is held by a task for a short while, and never more than one at a
+ * time by one task, so running out of slots is a bug.
+ *
+ * Return: The kernel virtual address of the frame, to be given back by
+ * kunmap().
+ */
+void *kmap(phys_addr_t page_phy_addr) {
+  enum intr_status old_status = intr_disable();
+  uint32_t slot, free_slot = KMAP_SLOTS;
+  for (slot = 0; slot < KMAP_SLOTS; slot++) {
+    if (kmap_busy[slot])
+      continue;
+    free_slot = slot;
+    if (kmap_phy_addr[slot] == page_phy_addr)
+      break;
+  }
+  if (free_slot == KMAP_SLOTS)
+    PANIC("kmap: out of slots");
+
+  uint32_t vaddr = kmap_base + free_slot * PAGE_SIZE;
+  if (slot == KMAP_SLOTS) {
+    *pte_ptr(vaddr) = (page_phy_addr | PG_G | PG_US_S | PG_RW_W | PG_P_1);
+    tlb_flush_page(vaddr);
+    kmap_phy_addr[free_slot] = page_phy_addr;
+  }
+  kmap_busy[free_slot] = true;
+  intr_set_status(old_status);
+  return (void *)vaddr;
+}
+
+/* give back a slot of kmap(), the mapping stays for the next kmap() of the
+ * same frame  */
+void kunmap(void *vaddr) {
+  uint32_t slot = ((uint32_t)vaddr - kmap_base) / PAGE_SIZE;
+  ASSERT(slot < KMAP_SLOTS && kmap_busy[slot]);
+  kmap_busy[slot] = false;
+}
+
+/**
+ * zeroed_page_get - Takes a pre-zeroed page frame from a pool.
+ * @m_pool: A pointer to the memory pool.
+ *
+ * Return: The physical address of the zeroed page frame, or 0 if the idle
+ * thread has not prepared any.
+ */
+static phys_addr_t zeroed_page_get(struct pool *m_pool) {
+  enum intr_status old_status = intr_disable();
+  if (list_empty(&m_pool->zeroed_pages)) {
+    intr_set_status(old_status);
+    return 0;
+  }
+  struct page *pg =
+      elem2entry(struct page, buddy_tag, list_pop(&m_pool->zeroed_pages));
+  m_pool->zeroed_cnt--;
+  intr_set_status(old_status);
+  return pool_frame_phy(m_pool, pg - m_pool->pages);
+}
+
+/**
+ * zeroed_page_refill - Zeroes one more page frame in advance.
+ *
+ * Picks the pool with fewer zeroed frames, takes a frame from its buddy
+ * allocator, clears it through a kmap() slot and queues it in the
+ * zeroed_pages list of the pool. Called by the idle thread only, so it must
+ * not block: the buddy allocator and the list are protected by disabling
+ * interrupts rather than by the pool lock.
+ *
+ * Return: True if a frame was zeroed, false if both pools have reached
+ * ZEROED_PAGES_TARGET or are out of free frames.
+ */
+bool zeroed_page_refill(void) {
+  struct pool *m_pool = (kernel_pool.zeroed_cnt <= user_pool.zeroed_cnt)
+                            ? &kernel_pool
+                            : &user_pool;
+  if (m_pool->zeroed_cnt >= ZEROED_PAGES_TARGET)
+    return false;
+
+  phys_addr_t page_phy_addr = palloc_pages(m_pool, 1);
+  if (page_phy_addr == 0)
+    return false;
+
+  void *page = kmap(page_phy_addr);
+  memset(page, 0, PAGE_SIZE);
+  kunmap(page);
+
+  uint32_t pg_idx = (page_phy_addr - m_pool->phy_addr_start) / PAGE_SIZE;
+  enum intr_status old_status = intr_disable();
+  list_append(&m_pool->zeroed_pages, &m_pool->pages[pg_idx].buddy_tag);
+  m_pool->zeroed_cnt++;
+  intr_set_status(old_status);
+  return true;
+}
+
 /**
  * palloc - Allocates a physical page from the given memory pool.
  * @m_pool: A pointer to the memory pool from which to allocate the page.
  *
- * Allocates a single physical page from the specified physical memory pool.
- * The function searches for a free bit in the pool's bitmap, marks it as used,
- * and returns the physical address of the allocated page.
+ * Allocates a single physical page from the specified physical memory pool
+ * by taking an order-0 block from its buddy allocator, or a pre-zeroed frame
+ * if the buddy allocator is exhausted. When the user pool runs low, the
+ * reclaim thread is woken to swap pages out, and when it is empty, a page is
+ * swapped out right away, so this may block on the disk.
  *
- * Return: A pointer to the start of the allocated physical page, or NULL if
- * no free page is available.
+ * Return: The physical address of the allocated page, or 0 if no free page
+ * is available.
  */
-static void *palloc(struct pool *m_pool) {
-  int bit_idx = bitmap_scan(&m_pool->pool_bitmap, 1);
-  if (bit_idx == -1)
-    return NULL;
-  bitmap_set(&m_pool->pool_bitmap, bit_idx, 1);
-  uint32_t page_phy_addr = m_pool->phy_addr_start + bit_idx * PAGE_SIZE;
-  return (void *)page_phy_addr;
+static phys_addr_t palloc(struct pool *m_pool) {
+  phys_addr_t page_phy_addr = palloc_pages(m_pool, 1);
+  /* the buddy allocator is exhausted, the zeroed frames are the last resort */
+  if (page_phy_addr == 0)
+    page_phy_addr = zeroed_page_get(m_pool);
+  if (m_pool == &user_pool) {
+    if (m_pool->free_cnt + m_pool->zeroed_cnt < SWAP_LOW_WATERMARK)
+      swap_wakeup();
+    /* the reclaim thread is too late, evict a page right now */
+    if (page_phy_addr == 0 && page_reclaim(1) == 1)
+      page_phy_addr = palloc_pages(m_pool, 1);
+  }
+  return page_phy_addr;
+}
+
+/**
+ * palloc_zeroed - Allocates a physical page that is preferably zeroed.
+ * @m_pool: A pointer to the memory pool from which to allocate the page.
+ * @zeroed: Set to true if the returned page is known to be all zero.
+ *
+ * Takes a frame zeroed by the idle thread if there is one, otherwise an
+ * ordinary frame, which the caller has to clear once it is mapped.
+ *
+ * Return: The physical address of the page, or 0 if the pool is empty.
+ */
+static phys_addr_t palloc_zeroed(struct pool *m_pool, bool *zeroed) {
+  phys_addr_t page_phy_addr = zeroed_page_get(m_pool);
+  *zeroed = (page_phy_addr != 0);
+  if (page_phy_addr == 0)
+    page_phy_addr = palloc(m_pool);
+  return page_phy_addr;
+}
+
+/**
+ * zero_page_init - Sets up the shared zero page.
+ *
+ * The frame comes from the user pool, since it is only mapped in user space,
+ * and is never freed.
+ */
+static void zero_page_init(void) {
+  zero_page_phy = palloc(&user_pool);
+  ASSERT(zero_page_phy != 0);
+  void *page = kmap(zero_page_phy);
+  memset(page, 0, PAGE_SIZE);
+  kunmap(page);
+}
+
+#ifdef PAE
+/* PG_NX for a user page of the current process outside any VM_EXEC region  */
+static pte_t user_page_nx(uint32_t vaddr) {
+  struct vm_area *vma = vma_find(running_thread(), vaddr);
+  return (vma != NULL && (vma->flags & VM_EXEC)) ? 0 : pg_nx;
+}
+#endif
+
+/* create the page table covering vaddr in the current page directory if it
+ * is missing, the new table is zeroed  */
+static void page_table_ensure(uint32_t vaddr) {
+  pte_t *pde = pde_ptr(vaddr);
+  if (*pde & PG_P_1)
+    return;
+  /* apply for a physical page as a page table in kernel_pool */
+  bool zeroed;
+  phys_addr_t pde_phy_addr = palloc_zeroed(&kernel_pool, &zeroed);
+  *pde = (pde_phy_addr | PG_US_U | PG_RW_W | PG_P_1);
+  /* memset requires a virtual address. Get the virtual address of the page
+   * table through the value of pte  */
+  if (!zeroed)
+    memset((void *)((int)pte_ptr(vaddr) & 0xfffff000), 0, PAGE_SIZE);
 }
 
 /**
@@ -321,31 +988,23 @@ static void *palloc(struct pool *m_pool) {
  * when setting up a new PTE. It also performs necessary bit manipulation for
  * setting the flags in the page table entries.
  */
-static void page_table_add(void *_vaddr, void *_page_phy_addr) {
+static void page_table_add(void *_vaddr, phys_addr_t page_phy_addr) {
   uint32_t vaddr = (uint32_t)_vaddr;
-  uint32_t page_phy_addr = (uint32_t)_page_phy_addr;
-  uint32_t *pde = pde_ptr(vaddr);
-  uint32_t *pte = pte_ptr(vaddr);
-
-  /* check if pde exists by bit present  */
-  if (*pde & 0x00000001) {
-    /* pde exists, which means the page table exists, so just create pte  */
-
-    /* make sure that pte does not exist*/
-    ASSERT(!(*pte & 0x00000001));
-
-    *pte = (page_phy_addr | PG_US_U | PG_RW_W | PG_P_1);
-  } else {
-    /* pde does not exists, which means the page table does not exists, so apply
-     * for a physical page as a page table in kernel_pool  */
-    uint32_t pde_phy_addr = (uint32_t)palloc(&kernel_pool);
-    *pde = (pde_phy_addr | PG_US_U | PG_RW_W | PG_P_1);
-    /* memset requires a virtual address. Get the virtual address of the page
-     * table through the value of pte  */
-    memset((void *)((int)pte & 0xfffff000), 0, PAGE_SIZE);
-
-    *pte = (page_phy_addr | PG_US_U | PG_RW_W | PG_P_1);
-  }
+  pte_t *pte = pte_ptr(vaddr);
+  /* kernel mappings are shared by all address spaces, keep them in TLB across
+   * the reload of CR3 */
+  pte_t pte_attr = PG_US_U | PG_RW_W | PG_P_1;
+  if (vaddr >= 0xc0000000)
+    pte_attr |= PG_G;
+#ifdef PAE
+  else
+    pte_attr |= user_page_nx(vaddr);
+#endif
+
+  page_table_ensure(vaddr);
+  /* make sure that pte does not exist*/
+  ASSERT(!(*pte & 0x00000001));
+  *pte = (page_phy_addr | pte_attr);
 }
 
 /**
@@ -368,8 +1027,9 @@ static void page_table_add(void *_vaddr, void *_page_phy_addr) {
  */
 void *malloc_page(enum pool_flags pf, uint32_t pg_cnt) {
   /* Make sure that the memory size represented by pg_cnt does not exceed the
-   * total physical memory size. 15MB/4KB = 3840*/
-  ASSERT(pg_cnt > 0 && pg_cnt < 3840);
+   * size of the pool */
+  ASSERT(pg_cnt > 0 && pg_cnt < ((pf & PF_KERNEL) ? kernel_pool.page_cnt
+                                                   : user_pool.page_cnt));
   /* allocate virtual pages */
   void *vaddr_start = vaddr_get(pf, pg_cnt);
   if (vaddr_start == NULL)
@@ -381,17 +1041,80 @@ void *malloc_page(enum pool_flags pf, uint32_t pg_cnt) {
 
   /* Allocate physical pages in corresponding pool, that is, establish a mapping
    * relationship between virtual pages and physical pages, that is, create PTE
-   * (and PDE possibly) */
+   * (and PDE possibly). Try a physically contiguous block first. */
+  phys_addr_t page_phy_addr = 0;
+  if (pg_cnt <= (1 << BUDDY_MAX_ORDER))
+    page_phy_addr = palloc_pages(mem_pool, pg_cnt);
+
+  if (page_phy_addr != 0) {
+    while (cnt-- > 0) {
+      page_table_add((void *)vaddr, page_phy_addr);
+      if (pf == PF_USER)
+        page_owner_set(page_phy_addr, vaddr);
+      vaddr += PAGE_SIZE;
+      page_phy_addr += PAGE_SIZE;
+    }
+    ALLOC_TRACE_ADD(vaddr_start, pg_cnt * PAGE_SIZE);
+    return vaddr_start;
+  }
+
+  /* the pool is too fragmented, fall back to one page at a time */
   while (cnt-- > 0) {
-    void *page_phy_addr = palloc(mem_pool);
-    if (page_phy_addr == NULL)
+    page_phy_addr = palloc(mem_pool);
+    if (page_phy_addr == 0)
       return NULL;
     page_table_add((void *)vaddr, page_phy_addr);
+    if (pf == PF_USER)
+      page_owner_set(page_phy_addr, vaddr);
     vaddr += PAGE_SIZE;
   }
+  ALLOC_TRACE_ADD(vaddr_start, pg_cnt * PAGE_SIZE);
   return vaddr_start;
 }
 
+/**
+ * malloc_zeroed_page() - Allocates a specified number of zeroed page spaces.
+ * @pf: The pool flag indicating which memory pool to use.
+ * @pg_cnt: The number of pages to allocate.
+ *
+ * Same as malloc_page(), except that the pages are cleared. A single page is
+ * taken from the frames zeroed by the idle thread when possible, so the
+ * memset is skipped on the allocation path. Larger kernel requests keep their
+ * physically contiguous block and are cleared here, while larger user
+ * requests only reserve the virtual pages: each one is backed by a zeroed
+ * frame on first touch, see page_fault_handler().
+ *
+ * Return: Returns the start address of the allocated virtual pages if
+ * successful, otherwise NULL.
+ */
+static void *malloc_zeroed_page(enum pool_flags pf, uint32_t pg_cnt) {
+  if (pg_cnt > 1 && pf == PF_USER)
+    return vaddr_get(pf, pg_cnt);
+
+  if (pg_cnt > 1) {
+    void *vaddr = malloc_page(pf, pg_cnt);
+    if (vaddr != NULL)
+      memset(vaddr, 0, pg_cnt * PAGE_SIZE);
+    return vaddr;
+  }
+
+  void *vaddr = vaddr_get(pf, 1);
+  if (vaddr == NULL)
+    return NULL;
+
+  bool zeroed;
+  struct pool *mem_pool = (pf & PF_KERNEL) ? &kernel_pool : &user_pool;
+  phys_addr_t page_phy_addr = palloc_zeroed(mem_pool, &zeroed);
+  if (page_phy_addr == 0)
+    return NULL;
+  page_table_add(vaddr, page_phy_addr);
+  if (!zeroed)
+    memset(vaddr, 0, PAGE_SIZE);
+  if (pf == PF_USER)
+    page_owner_set(page_phy_addr, (uint32_t)vaddr);
+  return vaddr;
+}
+
 /**
  * get_kernel_pages() - Allocates kernel pages and initializes them to zero.
  * @pg_cnt: The number of pages to allocate.
@@ -402,18 +1125,29 @@ void *malloc_page(enum pool_flags pf, uint32_t pg_cnt) {
  * particularly used for kernel space memory allocations where initialization is
  * required.
  *
+ * The lock of the kernel pool is held meanwhile, as the scan and update of
+ * the kernel virtual bitmap run with interrupts enabled.
+ *
  * Context: Used when kernel space memory is required, and the allocated memory
  * needs to be initialized to zero.
  * Return: Returns the start address of the allocated and initialized virtual
  * pages if successful, otherwise NULL.
  */
 void *get_kernel_pages(uint32_t pg_cnt) {
-  void *vaddr = malloc_page(PF_KERNEL, pg_cnt);
-  if (vaddr != NULL)
-    memset(vaddr, 0, pg_cnt * PAGE_SIZE);
+  lock_acquire(&kernel_pool._lock);
+  void *vaddr = malloc_zeroed_page(PF_KERNEL, pg_cnt);
+  lock_release(&kernel_pool._lock);
+  ALLOC_TRACE_ADD(vaddr, pg_cnt * PAGE_SIZE);
   return vaddr;
 }
 
+/* free 'pg_cnt' pages of get_kernel_pages() under the lock of the pool  */
+void free_kernel_pages(void *vaddr, uint32_t pg_cnt) {
+  lock_acquire(&kernel_pool._lock);
+  mfree_page(PF_KERNEL, vaddr, pg_cnt);
+  lock_release(&kernel_pool._lock);
+}
+
 /**
  * get_user_page - Allocates user space pages
  * @pg_cnt: The number of 4K pages to allocate
@@ -426,10 +1160,9 @@ void *get_kernel_pages(uint32_t pg_cnt) {
  */
 void *get_user_page(uint32_t pg_cnt) {
   lock_acquire(&user_pool._lock);
-  void *vaddr = malloc_page(PF_USER, pg_cnt);
-  if (vaddr != NULL)
-    memset(vaddr, 0, pg_cnt * PAGE_SIZE);
+  void *vaddr = malloc_zeroed_page(PF_USER, pg_cnt);
   lock_release(&user_pool._lock);
+  ALLOC_TRACE_ADD(vaddr, pg_cnt * PAGE_SIZE);
   return vaddr;
 }
 
@@ -441,8 +1174,8 @@ void *get_user_page(uint32_t pg_cnt) {
  *
  * Maps a given virtual address 'vaddr' to a physical page from the specified
  * pool 'pf' (user or kernel). The function first acquires a lock on the memory
- * pool, calculates the bitmap index from the virtual address, sets the
- * corresponding bit in the bitmap to indicate the page is used, allocates a
+ * pool, marks the page as used (in the kernel bitmap, or by adding a one page
+ * region to the user address space unless a region covers it), allocates a
  * physical page, and adds the mapping between the virtual address and the
  * physical page. Releases the lock before returning. If the physical page
  * allocation fails, returns NULL.
@@ -454,9 +1187,11 @@ void *get_a_page(enum pool_flags pf, uint32_t vaddr) {
   int32_t bit_idx = -1;
 
   if (cur_thread->pg_dir != NULL && pf == PF_USER) {
-    bit_idx = (vaddr - cur_thread->userprog_vaddr.vaddr_start) / PAGE_SIZE;
-    ASSERT(bit_idx > 0);
-    bitmap_set(&cur_thread->userprog_vaddr.vaddr_bitmap, bit_idx, 1);
+    if (vma_find(cur_thread, vaddr) == NULL &&
+        !vma_insert(cur_thread, vaddr, PAGE_SIZE, VM_READ | VM_WRITE)) {
+      lock_release(&mem_pool->_lock);
+      return NULL;
+    }
   } else if (cur_thread->pg_dir == NULL && pf == PF_KERNEL) {
     bit_idx = (vaddr - kernel_vaddr.vaddr_start) / PAGE_SIZE;
     ASSERT(bit_idx > 0);
@@ -464,12 +1199,21 @@ void *get_a_page(enum pool_flags pf, uint32_t vaddr) {
   } else {
     PANIC("Unable to establish mapping between pf and vaddr");
   }
-  void *page_phy_addr = palloc(mem_pool);
-  if (page_phy_addr == NULL) {
+  phys_addr_t page_phy_addr = palloc(mem_pool);
+  if (page_phy_addr == 0) {
     lock_release(&mem_pool->_lock);
     return NULL;
   }
+  /* the old content of a swapped out page is replaced */
+  enum intr_status old_status = intr_disable();
+  if (pf == PF_USER && page_swapped(vaddr)) {
+    swap_slot_free(*pte_ptr(vaddr) >> 12);
+    *pte_ptr(vaddr) = 0;
+  }
+  intr_set_status(old_status);
   page_table_add((void *)vaddr, page_phy_addr);
+  if (pf == PF_USER)
+    page_owner_set(page_phy_addr, vaddr);
   lock_release(&mem_pool->_lock);
   return (void *)vaddr;
 }
@@ -486,9 +1230,529 @@ void *get_a_page(enum pool_flags pf, uint32_t vaddr) {
  * (extracted from the page table entry) with the low 12 bits of the original
  * virtual address to form the complete physical address.
  */
-uint32_t addr_v2p(uint32_t vaddr) {
-  uint32_t *pte_phy_addr = pte_ptr(vaddr);
-  return ((*pte_phy_addr & 0xfffff000) + (vaddr & 0x00000fff));
+phys_addr_t addr_v2p(uint32_t vaddr) {
+  pte_t *pte_phy_addr = pte_ptr(vaddr);
+  return ((*pte_phy_addr & PG_FRAME) + (vaddr & 0x00000fff));
+}
+
+/**
+ * page_mapped - Checks whether a virtual address is backed by a page frame.
+ * @vaddr: The virtual address to check.
+ *
+ * The PDE is checked first, since reading the PTE of a missing page table
+ * through pte_ptr() would fault itself.
+ *
+ * Return: True if both the PDE and the PTE of 'vaddr' are present.
+ */
+bool page_mapped(uint32_t vaddr) {
+  return (*pde_ptr(vaddr) & PG_P_1) && (*pte_ptr(vaddr) & PG_P_1);
+}
+
+/* descriptor of the page frame at page_phy_addr */
+static struct page *phy_to_page(phys_addr_t page_phy_addr) {
+  struct pool *mem_pool =
+      (page_phy_addr >= user_pool.phy_addr_start) ? &user_pool : &kernel_pool;
+  uint32_t pg_idx = (page_phy_addr - mem_pool->phy_addr_start) / PAGE_SIZE;
+  ASSERT(pg_idx < mem_pool->page_cnt);
+  return &mem_pool->pages[pg_idx];
+}
+
+/* record that the current process alone maps the user frame at vaddr, which
+ * makes it a candidate for page_reclaim()  */
+static void page_owner_set(phys_addr_t page_phy_addr, uint32_t vaddr) {
+  struct page *pg = phy_to_page(page_phy_addr);
+  pg->vaddr = vaddr;
+  pg->owner = running_thread();
+}
+
+/**
+ * page_cow_share - Shares a user page of the current process copy-on-write.
+ * @vaddr: A mapped user virtual address, page aligned.
+ *
+ * Write-protects the PTE of 'vaddr', marks it PG_COW and counts the page
+ * table about to map the same frame (see page_map_in()) as one more sharer.
+ *
+ * Context: Called by fork in the address space of the parent.
+ * Return: The PTE mapping the same frame copy-on-write in the child.
+ */
+pte_t page_cow_share(uint32_t vaddr) {
+  pte_t *pte = pte_ptr(vaddr);
+  phys_addr_t page_phy_addr = *pte & PG_FRAME;
+  enum intr_status old_status = intr_disable();
+  *pte = (*pte & ~PG_RW_W) | PG_COW;
+  tlb_flush_page(vaddr);
+  if (page_phy_addr == zero_page_phy) {
+    zero_page_saved++;
+  } else {
+    struct page *pg = phy_to_page(page_phy_addr);
+    pg->share_cnt++;
+    pg->owner = NULL;
+  }
+  intr_set_status(old_status);
+  return page_phy_addr | (*pte & PG_NX) | PG_COW | PG_US_U | PG_P_1;
+}
+
+/**
+ * page_share - Shares a user page of the current process writable.
+ * @vaddr: A mapped user virtual address in a VM_SHARED region, page aligned.
+ *
+ * Context: Called by fork in the address space of the parent.
+ * Return: The PTE mapping the same frame in the child.
+ */
+pte_t page_share(uint32_t vaddr) {
+  pte_t *pte = pte_ptr(vaddr);
+  phys_addr_t page_phy_addr = *pte & PG_FRAME;
+  enum intr_status old_status = intr_disable();
+  struct page *pg = phy_to_page(page_phy_addr);
+  pg->share_cnt++;
+  pg->owner = NULL;
+  intr_set_status(old_status);
+  return page_phy_addr | (*pte & PG_NX) | PG_US_U | PG_RW_W | PG_P_1;
+}
+
+/**
+ * page_map_in - Sets a user PTE in the address space of another task.
+ * @pthread: The user process whose page tables are written.
+ * @vaddr: The user virtual address, page aligned.
+ * @pte: The PTE to set, from page_cow_share(), page_share() or
+ * page_swap_share().
+ *
+ * The page table is reached through a kmap() slot rather than by switching
+ * to the page directory of 'pthread', so that the TLB of the running task is
+ * kept. A missing page table is allocated and cleared the same way.
+ */
+void page_map_in(struct task_struct *pthread, uint32_t vaddr, pte_t pte) {
+  pte_t *pde = &pthread->pg_dir[PDE_IDX(vaddr)];
+  if (!(*pde & PG_P_1)) {
+    bool zeroed;
+    phys_addr_t table_phy_addr = palloc_zeroed(&kernel_pool, &zeroed);
+    if (!zeroed) {
+      void *table = kmap(table_phy_addr);
+      memset(table, 0, PAGE_SIZE);
+      kunmap(table);
+    }
+    *pde = (table_phy_addr | PG_US_U | PG_RW_W | PG_P_1);
+  }
+  pte_t *table = kmap(*pde & PG_FRAME);
+  table[PTE_IDX(vaddr)] = pte;
+  kunmap(table);
+}
+
+/**
+ * page_cow_map - Maps a frame copy-on-write in the current process.
+ * @vaddr: The user virtual address, page aligned.
+ * @page_phy_addr: The physical address of the frame.
+ *
+ * Context: Called by the #PF handler to map the zero page.
+ */
+void page_cow_map(uint32_t vaddr, phys_addr_t page_phy_addr) {
+  page_table_add((void *)vaddr, page_phy_addr);
+  pte_t *pte = pte_ptr(vaddr);
+  *pte = (*pte & ~PG_RW_W) | PG_COW;
+}
+
+/**
+ * page_share_map - Maps a frame owned by someone else as one more sharer.
+ * @vaddr: The user virtual address, page aligned.
+ * @page_phy_addr: The physical address of the frame.
+ *
+ * The mapping is writable and not copy-on-write, all sharers see each other's
+ * writes. It is dropped by pfree() like any other mapping, the frame is only
+ * freed with the last one.
+ */
+void page_share_map(uint32_t vaddr, phys_addr_t page_phy_addr) {
+  enum intr_status old_status = intr_disable();
+  struct page *pg = phy_to_page(page_phy_addr);
+  pg->share_cnt++;
+  pg->owner = NULL;
+  intr_set_status(old_status);
+  page_table_add((void *)vaddr, page_phy_addr);
+}
+
+/**
+ * page_set_prot - Sets whether a mapped user page is writable.
+ * @vaddr: A mapped user virtual address, page aligned.
+ * @writable: True to allow writes.
+ *
+ * The dirty bit is cleared as well, so that it tells whether the page is
+ * written from now on.
+ */
+void page_set_prot(uint32_t vaddr, bool writable) {
+  pte_t *pte = pte_ptr(vaddr);
+  *pte &= ~PG_D;
+  if (writable)
+    *pte |= PG_RW_W;
+  else
+    *pte &= ~PG_RW_W;
+  tlb_flush_page(vaddr);
+}
+
+/**
+ * page_set_exec - Sets whether instructions may be fetched from a mapped
+ * user page.
+ * @vaddr: A mapped user virtual address, page aligned.
+ * @executable: True to clear NX, false to set it if the CPU supports it.
+ *
+ * Only has an effect with PAE, there is no NX bit without it.
+ */
+void page_set_exec(uint32_t vaddr, bool executable) {
+#ifdef PAE
+  pte_t *pte = pte_ptr(vaddr);
+  if (executable)
+    *pte &= ~PG_NX;
+  else
+    *pte |= pg_nx;
+  tlb_flush_page(vaddr);
+#else
+  (void)vaddr;
+  (void)executable;
+#endif
+}
+
+/**
+ * frame_alloc_zeroed - Allocates a zero-filled page frame without mapping it.
+ * @pf: The pool to allocate from.
+ *
+ * A frame that is not pre-zeroed is cleared through a kmap() slot.
+ *
+ * Return: The physical address of the frame, or 0 if the pool is exhausted.
+ */
+phys_addr_t frame_alloc_zeroed(enum pool_flags pf) {
+  struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+  bool zeroed;
+  lock_acquire(&mem_pool->_lock);
+  phys_addr_t page_phy_addr = palloc_zeroed(mem_pool, &zeroed);
+  lock_release(&mem_pool->_lock);
+  if (page_phy_addr != 0 && !zeroed) {
+    void *page = kmap(page_phy_addr);
+    memset(page, 0, PAGE_SIZE);
+    kunmap(page);
+  }
+  return page_phy_addr;
+}
+
+/* number of free page frames in a pool, the pre-zeroed ones included  */
+uint32_t pool_free_pages(enum pool_flags pf) {
+  struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+  return mem_pool->free_cnt + mem_pool->zeroed_cnt;
+}
+
+/**
+ * page_swapped - Checks whether a user page is swapped out.
+ * @vaddr: A user virtual address in the current process, page aligned.
+ *
+ * Return: True if the PTE of 'vaddr' holds a swap entry.
+ */
+bool page_swapped(uint32_t vaddr) {
+  return (*pde_ptr(vaddr) & PG_P_1) && !(*pte_ptr(vaddr) & PG_P_1) &&
+         (*pte_ptr(vaddr) & PG_SWAP);
+}
+
+/**
+ * page_swap_share - Shares a swapped out page of the current process.
+ * @vaddr: A swapped out user virtual address, page aligned.
+ *
+ * Context: Called by fork in the address space of the parent.
+ * Return: The swap entry, to be passed to page_map_in().
+ */
+pte_t page_swap_share(uint32_t vaddr) {
+  pte_t swap_pte = *pte_ptr(vaddr);
+  swap_slot_dup(swap_pte >> 12);
+  return swap_pte;
+}
+
+/**
+ * page_evict - Gives a frame a second chance or unmaps it for swapping.
+ * @pg: The descriptor of a user frame with an owner.
+ * @page_phy_addr: The physical address of the frame.
+ *
+ * The PTE of the frame is looked up in the page directory of its owner. If
+ * the page was accessed since the last look, only the accessed bit is
+ * cleared. Otherwise the PTE is replaced by the swap entry of a new slot, so
+ * that the owner faults on the page from now on.
+ *
+ * Context: Interrupts must be disabled, the page directory is switched.
+ * Return: The slot the frame has to be written to, -1 if it was accessed, or
+ * -2 if the swap area is full.
+ */
+static int32_t page_evict(struct page *pg, phys_addr_t page_phy_addr) {
+  struct task_struct *cur = running_thread();
+  struct task_struct *owner = pg->owner;
+  int32_t slot = -1;
+  if (owner != cur)
+    page_dir_activate(owner);
+
+  pte_t *pte = pte_ptr(pg->vaddr);
+  ASSERT(page_mapped(pg->vaddr) && (*pte & PG_FRAME) == page_phy_addr);
+  if (*pte & PG_A) {
+    *pte &= ~PG_A;
+  } else {
+    slot = swap_slot_alloc();
+    if (slot >= 0) {
+      *pte = ((pte_t)slot << 12) | PG_SWAP;
+      pg->owner = NULL;
+    } else {
+      slot = -2;
+    }
+  }
+
+  /* switching back flushes the user translations of the owner */
+  if (owner != cur)
+    page_dir_activate(cur);
+  else
+    tlb_flush_page(pg->vaddr);
+  return slot;
+}
+
+/**
+ * page_reclaim - Swaps out user pages to free their frames.
+ * @target: The number of frames wanted.
+ *
+ * The frames of user_pool are scanned in a circle by the CLOCK algorithm: the
+ * hand skips frames that may not be swapped out, gives a frame whose page was
+ * accessed since the last pass a second chance, and evicts the first one that
+ * was not. The evicted frame is copied to swap_bounce through a kmap() slot,
+ * which is given back before the copy is written to its slot, and freed. At most two full turns are made, so a page accessed all the
+ * time is not evicted.
+ *
+ * Context: May block on the disk. Called by the reclaim thread, and by
+ * palloc() when the user pool is empty.
+ * Return: The number of frames freed, 0 if there is no swap area.
+ */
+uint32_t page_reclaim(uint32_t target) {
+  if (swap_part == NULL || user_pool.page_cnt == 0)
+    return 0;
+  lock_acquire(&swap_lock);
+  if (swap_bounce == NULL)
+    swap_bounce = get_kernel_pages(1);
+  if (swap_bounce == NULL) {
+    lock_release(&swap_lock);
+    return 0;
+  }
+  uint32_t reclaimed = 0;
+  uint32_t scanned = 0;
+  while (reclaimed < target && scanned < 2 * user_pool.page_cnt) {
+    struct page *pg = &user_pool.pages[clock_hand];
+    phys_addr_t page_phy_addr = pool_frame_phy(&user_pool, clock_hand);
+    if (++clock_hand == user_pool.page_cnt)
+      clock_hand = 0;
+    scanned++;
+
+    enum intr_status old_status = intr_disable();
+    int32_t slot = (pg->owner != NULL) ? page_evict(pg, page_phy_addr) : -1;
+    if (slot < 0) {
+      intr_set_status(old_status);
+      if (slot == -2)
+        break;
+      continue;
+    }
+    intr_set_status(old_status);
+    void *page = kmap(page_phy_addr);
+    memcpy(swap_bounce, page, PAGE_SIZE);
+    kunmap(page);
+    swap_write(slot, swap_bounce);
+    pfree(page_phy_addr);
+    reclaimed++;
+  }
+  lock_release(&swap_lock);
+  return reclaimed;
+}
+
+/**
+ * page_swap_in - Reads a swapped out page of the current process back.
+ * @vaddr: A swapped out user virtual address, page aligned.
+ *
+ * The page is read straight into a new frame mapped at 'vaddr', which only
+ * becomes a candidate for eviction again once it is read. If the page was
+ * being written to swap, swap_lock makes this wait until it is done.
+ *
+ * palloc() and swap_lock may block, so the PTE is checked again afterwards.
+ * If it no longer holds the same swap entry, the new frame is given back
+ * and the fault is simply retried.
+ *
+ * Return: True on success, false if no frame is left.
+ */
+static bool page_swap_in(uint32_t vaddr) {
+  pte_t swap_pte = *pte_ptr(vaddr);
+  phys_addr_t page_phy_addr = palloc(&user_pool);
+  if (page_phy_addr == 0)
+    return false;
+  lock_acquire(&swap_lock);
+  if (*pte_ptr(vaddr) != swap_pte) {
+    lock_release(&swap_lock);
+    pfree(page_phy_addr);
+    return true;
+  }
+  uint32_t slot = swap_pte >> 12;
+  *pte_ptr(vaddr) = 0;
+  page_table_add((void *)vaddr, page_phy_addr);
+  swap_read(slot, (void *)vaddr);
+  swap_slot_free(slot);
+  page_owner_set(page_phy_addr, vaddr);
+  lock_release(&swap_lock);
+  return true;
+}
+
+/* the PTE still maps the same frame copy-on-write as 'old_pte' */
+static bool page_cow_unchanged(pte_t *pte, pte_t old_pte) {
+  return (*pte & (PG_P_1 | PG_COW | PG_FRAME)) ==
+         (old_pte & (PG_P_1 | PG_COW | PG_FRAME));
+}
+
+/**
+ * page_cow_break - Gives the current process its own copy of a COW page.
+ * @vaddr: A mapped user virtual address, page aligned.
+ *
+ * If other page tables still share the frame, the content is copied into a
+ * new frame through a kmap() slot, otherwise the current process is the
+ * last user of the frame and simply takes it over. The zero page is never
+ * taken over nor copied, a zeroed frame replaces it. Either way the PTE is
+ * made writable again.
+ *
+ * Allocating the new frame may block in page_reclaim(). If the PTE does not
+ * map the same frame copy-on-write afterwards, the frame is given back and
+ * the fault is retried with whatever the PTE holds now.
+ *
+ * Return: True on success or retry, false if 'vaddr' is not copy-on-write
+ * or no frame is left for the copy.
+ */
+static bool page_cow_break(uint32_t vaddr) {
+  pte_t *pte = pte_ptr(vaddr);
+  if (!(*pte & PG_COW))
+    return false;
+
+  pte_t old_pte = *pte;
+  phys_addr_t page_phy_addr = old_pte & PG_FRAME;
+  pte_t nx = old_pte & PG_NX;
+  if (page_phy_addr == zero_page_phy) {
+    bool zeroed;
+    phys_addr_t new_phy_addr = palloc_zeroed(&user_pool, &zeroed);
+    if (new_phy_addr == 0)
+      return false;
+    if (!page_cow_unchanged(pte, old_pte)) {
+      pfree(new_phy_addr);
+      return true;
+    }
+    zero_page_saved--;
+    *pte = (new_phy_addr | nx | PG_US_U | PG_RW_W | PG_P_1);
+    tlb_flush_page(vaddr);
+    if (!zeroed)
+      memset((void *)vaddr, 0, PAGE_SIZE);
+    page_owner_set(new_phy_addr, vaddr);
+    return true;
+  }
+
+  struct page *pg = phy_to_page(page_phy_addr);
+  if (pg->share_cnt > 0) {
+    phys_addr_t copy_phy_addr = palloc(&user_pool);
+    if (copy_phy_addr == 0)
+      return false;
+    if (!page_cow_unchanged(pte, old_pte)) {
+      pfree(copy_phy_addr);
+      return true;
+    }
+    /* palloc() may have blocked in page_reclaim(), and the other sharers
+     * may have gone meanwhile */
+    if (pg->share_cnt > 0) {
+      void *copy = kmap(copy_phy_addr);
+      memcpy(copy, (void *)vaddr, PAGE_SIZE);
+      kunmap(copy);
+      pg->share_cnt--;
+      page_phy_addr = copy_phy_addr;
+    } else {
+      pfree(copy_phy_addr);
+    }
+  }
+  *pte = (page_phy_addr | nx | PG_US_U | PG_RW_W | PG_P_1);
+  tlb_flush_page(vaddr);
+  page_owner_set(page_phy_addr, vaddr);
+  return true;
+}
+
+/**
+ * page_fault_fixup - Backs a user page with a frame on its first touch.
+ * @fault_vaddr: The faulting address read from CR2.
+ *
+ * A write fault on a copy-on-write page is resolved by page_cow_break(). A
+ * fault on a missing page is resolved if the page is in a region of the
+ * current process (lazily allocated heap), and for the stack region only if
+ * it is no lower than 32 bytes under the user esp ('push' and 'pusha' touch
+ * memory below esp before moving it).
+ * The user esp is taken from the interrupt frame at the top of the kernel
+ * stack, which is the frame of this fault or of the syscall the kernel is
+ * serving when the fault happened.
+ *
+ * A page that was swapped out is read back by page_swap_in(). A page of a
+ * file mapping is filled from the page cache. A heap page is
+ * first mapped read-only to the shared zero page, so memory that is only read
+ * never gets a frame. The error code is not needed to tell
+ * reads from writes: a write faults again on the now present page and
+ * page_cow_break() gives it a zeroed frame. The stack is almost always
+ * written first, so a stack page gets a zero-filled frame right away.
+ *
+ * Context: Runs in the #PF handler with interrupts disabled, so the pools
+ * are updated without taking locks. Filling a page of a file mapping,
+ * swapping a page in, or swapping another one out to make room, may block on
+ * the disk.
+ * Return: True if a page was mapped, false if the fault is a real error.
+ */
+static bool page_fault_fixup(uint32_t fault_vaddr) {
+  struct task_struct *cur = running_thread();
+  uint32_t vaddr = fault_vaddr & 0xfffff000;
+  if (cur->pg_dir == NULL || vaddr >= 0xc0000000)
+    return false;
+
+  /* a present page only faults on write */
+  if (page_mapped(vaddr))
+    return page_cow_break(vaddr);
+  if (page_swapped(vaddr))
+    return page_swap_in(vaddr);
+
+  struct vm_area *vma = vma_find(cur, vaddr);
+  if (vma == NULL)
+    return false;
+  if (vma->flags & VM_FILE)
+    return page_cache_fault(vma, vaddr);
+  if (vma->flags & VM_STACK) {
+    /* the stack only grows down to where the user esp is */
+    struct intr_stack *frame =
+        (struct intr_stack *)((uint32_t)cur + PAGE_SIZE -
+                              sizeof(struct intr_stack));
+    if (fault_vaddr + 32 < (uint32_t)frame->esp)
+      return false;
+  } else {
+    page_cow_map(vaddr, zero_page_phy);
+    zero_page_saved++;
+    return true;
+  }
+
+  bool zeroed;
+  phys_addr_t page_phy_addr = palloc_zeroed(&user_pool, &zeroed);
+  if (page_phy_addr == 0)
+    return false;
+  page_table_add((void *)vaddr, page_phy_addr);
+  if (!zeroed)
+    memset((void *)vaddr, 0, PAGE_SIZE);
+  page_owner_set(page_phy_addr, vaddr);
+  return true;
+}
+
+/**
+ * page_fault_handler - Handler of #PF (vector 0x0e).
+ * @vec_nr: The interrupt vector number.
+ *
+ * Resolves demand faults of user processes by page_fault_fixup(), anything
+ * else is fatal.
+ */
+static void page_fault_handler(uint8_t vec_nr) {
+  uint32_t fault_vaddr;
+  asm volatile("movl %%cr2,%0" : "=r"(fault_vaddr));
+  if (page_fault_fixup(fault_vaddr))
+    return;
+
+  put_str("\npage fault addr is ");
+  put_int(fault_vaddr);
+  PANIC("unresolved page fault");
 }
 
 /**
@@ -528,6 +1792,113 @@ static struct arena *block_2_arena(struct mem_block *mb) {
   return (struct arena *)((uint32_t)mb & 0xfffff000);
 }
 
+/**
+ * arena_new() - Add a new arena to a memory block descriptor.
+ * @pf: The pool flag indicating which memory pool to use.
+ * @desc: The memory block descriptor of the size class.
+ *
+ * Allocates a zeroed page as arena and splits it into blocks, adding them to
+ * the free list of 'desc'.
+ *
+ * Context: The lock of the memory pool is held by the caller.
+ * Return: True on success, false if no page is left.
+ */
+static bool arena_new(enum pool_flags pf, struct mem_block_desc *desc) {
+  struct arena *a = malloc_zeroed_page(pf, 1);
+  if (a == NULL)
+    return false;
+  a->desc = desc;
+  a->large_mb = false;
+  a->cnt = desc->block_per_arena;
+  desc->arena_cnt++;
+
+  /* Divide memory blocks in page frames  (arena)  */
+  uint32_t block_idx;
+  enum intr_status old_status = intr_disable();
+  for (block_idx = 0; block_idx < desc->block_per_arena; block_idx++) {
+    struct mem_block *b = arena_2_block(a, block_idx);
+    ASSERT(!list_elem_find(&desc->free_list, &b->free_elem));
+    list_append(&desc->free_list, &b->free_elem);
+  }
+  intr_set_status(old_status);
+  return true;
+}
+
+/* push a free block into a magazine, blocks are chained by free_elem.next */
+static void mag_push(struct mem_magazine *mag, struct mem_block *b) {
+  b->free_elem.next = mag->top;
+  mag->top = &b->free_elem;
+  mag->cnt++;
+}
+
+/* pop a free block from a non-empty magazine */
+static struct mem_block *mag_pop(struct mem_magazine *mag) {
+  struct mem_block *b = elem2entry(struct mem_block, free_elem, mag->top);
+  mag->top = b->free_elem.next;
+  mag->cnt--;
+  return b;
+}
+
+/**
+ * mag_refill() - Move a batch of free blocks from a size class to a magazine.
+ * @mem_pool: The memory pool of the blocks.
+ * @pf: The pool flag of 'mem_pool'.
+ * @desc: The memory block descriptor of the size class.
+ * @mag: The empty magazine of the running task for this size class.
+ *
+ * Takes up to MAG_BATCH blocks under the pool lock, adding arenas when the
+ * free list runs out. The blocks count as allocated for their arenas.
+ *
+ * Return: True if at least one block was moved.
+ */
+static bool mag_refill(struct pool *mem_pool, enum pool_flags pf,
+                       struct mem_block_desc *desc, struct mem_magazine *mag) {
+  lock_acquire(&mem_pool->_lock);
+  while (mag->cnt < MAG_BATCH) {
+    if (list_empty(&desc->free_list) && !arena_new(pf, desc))
+      break;
+    struct mem_block *b =
+        elem2entry(struct mem_block, free_elem, list_pop(&desc->free_list));
+    block_2_arena(b)->cnt--;
+    mag_push(mag, b);
+  }
+  lock_release(&mem_pool->_lock);
+  return mag->cnt > 0;
+}
+
+/**
+ * mag_flush() - Give a batch of blocks of a magazine back to their arenas.
+ * @mem_pool: The memory pool of the blocks.
+ * @pf: The pool flag of 'mem_pool'.
+ * @mag: The magazine of the running task.
+ * @cnt: The number of blocks to give back.
+ *
+ * Each block goes back to the free list of its size class under the pool
+ * lock, and an arena whose blocks are all free again is released.
+ */
+static void mag_flush(struct pool *mem_pool, enum pool_flags pf,
+                      struct mem_magazine *mag, uint32_t cnt) {
+  lock_acquire(&mem_pool->_lock);
+  while (cnt-- > 0 && mag->cnt > 0) {
+    struct mem_block *b = mag_pop(mag);
+    struct arena *a = block_2_arena(b);
+    list_append(&a->desc->free_list, &b->free_elem);
+
+    /* the whole page is unused, free it  */
+    if (++a->cnt == a->desc->block_per_arena) {
+      uint32_t block_idx;
+      for (block_idx = 0; block_idx < a->desc->block_per_arena; block_idx++) {
+        struct mem_block *b = arena_2_block(a, block_idx);
+        ASSERT(list_elem_find(&a->desc->free_list, &b->free_elem));
+        list_remove(&b->free_elem);
+      }
+      a->desc->arena_cnt--;
+      mfree_page(pf, a, 1);
+    }
+  }
+  lock_release(&mem_pool->_lock);
+}
+
 /**
  * sys_malloc() - Allocate memory in the heap.
  * @size: The number of bytes to allocate.
@@ -542,9 +1913,11 @@ static struct arena *block_2_arena(struct mem_block *mb) {
  * If the allocation size exceeds the memory pool size or is non-positive, it
  * returns NULL. For large allocations (size > 1024), it allocates whole page
  * frames. For smaller sizes, it uses pre-defined memory block sizes to find a
- * fit. If no blocks are available, it allocates a new memory arena (page frame)
- * and splits it into blocks, adding them to the free list of the corresponding
- * memory block descriptor. The allocated memory is zeroed before returning.
+ * fit, and takes the block from the magazine of the running task for that
+ * size class without any lock. Only an empty magazine is refilled in a batch
+ * from the free list of the memory block descriptor under the pool lock,
+ * allocating new arenas as needed. The allocated memory is zeroed before
+ * returning.
  *
  * Context: This function is used in the implementation of a dynamic memory
  * allocator for an operating system, handling both kernel and user memory
@@ -574,20 +1947,18 @@ void *sys_malloc(uint32_t _size) {
   if (!(_size < pool_size))
     return NULL;
 
-  struct arena *a = NULL;
-  struct mem_block *b = NULL;
-  lock_acquire(&mem_pool->_lock);
-
   if (_size > 1024) {
     /******** allocate large memory ********/
+    lock_acquire(&mem_pool->_lock);
     uint32_t pg_cnt = DIV_ROUND_UP(_size + sizeof(struct arena), PAGE_SIZE);
-    a = malloc_page(PF, pg_cnt);
+    struct arena *a = malloc_zeroed_page(PF, pg_cnt);
     if (a != NULL) {
-      memset(a, 0, pg_cnt * PAGE_SIZE);
       a->desc = NULL;
       a->cnt = pg_cnt;
       a->large_mb = true;
       lock_release(&mem_pool->_lock);
+      /* recorded by the arena, which mfree_page() gets back from sys_free() */
+      ALLOC_TRACE_ADD(a, _size);
       /* the '+1' here is to skip over the metadata of arena */
       return (void *)(a + 1);
     } else {
@@ -604,38 +1975,18 @@ void *sys_malloc(uint32_t _size) {
         break;
     }
 
-    if (list_empty(&desc[desc_idx].free_list)) {
-      /* no available blocks, allocate new arena */
-      a = malloc_page(PF, 1);
-      if (a == NULL) {
-        lock_release(&mem_pool->_lock);
+    /* the magazine is private to the running task, no lock is needed  */
+    struct mem_magazine *mag = &cur_thread->mb_mag_arr[desc_idx];
+    if (mag->cnt > 0) {
+      mag->alloc_hit++;
+    } else {
+      mag->alloc_miss++;
+      if (!mag_refill(mem_pool, PF, &desc[desc_idx], mag))
         return NULL;
-      }
-      memset(a, 0, PAGE_SIZE);
-      a->desc = &desc[desc_idx];
-      a->large_mb = false;
-      a->cnt = desc[desc_idx].block_per_arena;
-
-      /* Divide memory blocks in page frames  (arena)  */
-      uint32_t block_idx;
-      enum intr_status old_status = intr_disable();
-      for (block_idx = 0; block_idx < a->desc->block_per_arena; block_idx++) {
-        b = arena_2_block(a, block_idx);
-        ASSERT(!list_elem_find(&a->desc->free_list, &b->free_elem));
-        list_append(&a->desc->free_list, &b->free_elem);
-      }
-      intr_set_status(old_status);
     }
-    /* now! allocate free memory block from free_list which maintained by memory
-     * block descriptor*/
-
-    /* get the address of target free memory block b from its member free_elem*/
-    b = elem2entry(struct mem_block, free_elem,
-                   list_pop(&desc[desc_idx].free_list));
+    struct mem_block *b = mag_pop(mag);
     memset(b, 0, desc[desc_idx].block_size);
-    a = block_2_arena(b);
-    --a->cnt;
-    lock_release(&mem_pool->_lock);
+    ALLOC_TRACE_ADD(b, _size);
     return (void *)b;
   }
 }
@@ -646,19 +1997,37 @@ void *sys_malloc(uint32_t _size) {
  *
  * This function recycles a given physical address back into the appropriate
  * physical memory pool. It determines whether the address belongs to the user
- * or kernel physical memory pool and clears the corresponding bit in the bitmap
- * to mark it as free.
+ * or kernel physical memory pool and gives the page frame back to its buddy
+ * allocator, where it is merged with its free buddies. A frame that is still
+ * shared copy-on-write only loses one of its sharers, and the zero page only
+ * one of its mappings.
  *
  * Context: Used for managing physical memory allocation by keeping track of
  *          allocated and free memory blocks.
  */
-void pfree(uint32_t page_phy_addr) {
+void pfree(phys_addr_t page_phy_addr) {
   struct pool *mem_pool;
-  uint32_t bit_idx = 0;
+  uint32_t pg_idx = 0;
   mem_pool =
       (page_phy_addr >= user_pool.phy_addr_start) ? &user_pool : &kernel_pool;
-  bit_idx = (page_phy_addr - mem_pool->phy_addr_start) / PAGE_SIZE;
-  bitmap_set(&mem_pool->pool_bitmap, bit_idx, 0);
+  pg_idx = (page_phy_addr - mem_pool->phy_addr_start) / PAGE_SIZE;
+  ASSERT(pg_idx < mem_pool->page_cnt && !mem_pool->pages[pg_idx].free);
+
+  /* the frame is still mapped copy-on-write by another process */
+  enum intr_status old_status = intr_disable();
+  if (page_phy_addr == zero_page_phy) {
+    zero_page_saved--;
+    intr_set_status(old_status);
+    return;
+  }
+  if (mem_pool->pages[pg_idx].share_cnt > 0) {
+    mem_pool->pages[pg_idx].share_cnt--;
+    intr_set_status(old_status);
+    return;
+  }
+  mem_pool->pages[pg_idx].owner = NULL;
+  intr_set_status(old_status);
+  buddy_free(mem_pool, pg_idx, 0);
 }
 
 /**
@@ -674,10 +2043,10 @@ void pfree(uint32_t page_phy_addr) {
  * part of freeing or reallocating memory.
  */
 static void page_table_pte_remove(uint32_t vaddr) {
-  uint32_t *pte = pte_ptr(vaddr);
+  pte_t *pte = pte_ptr(vaddr);
   *pte &= PG_P_0;
   /* update TLB entry  */
-  asm volatile("invlpg %0" ::"m"(vaddr) : "memory");
+  tlb_flush_page(vaddr);
 }
 
 /**
@@ -688,9 +2057,9 @@ static void page_table_pte_remove(uint32_t vaddr) {
  * @pg_cnt: The number of pages to free starting from _vaddr.
  *
  * This function frees a continuous range of virtual pages from the specified
- * virtual address pool. It clears the bits in the bitmap corresponding to these
- * addresses, effectively marking them as free. It handles both kernel and user
- * virtual memory pools.
+ * virtual address pool. For the kernel it clears the bits in the bitmap
+ * corresponding to these addresses, for a user process it removes the range
+ * from the regions of its address space.
  *
  * Context: Used in the process of deallocating virtual memory, particularly
  * when freeing multiple contiguous virtual pages.
@@ -707,13 +2076,7 @@ static void vaddr_remove(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt) {
     }
   } else {
     /* for user  */
-    struct task_struct *cur_thread = running_thread();
-    allocated_bit_idx_start =
-        (vaddr - cur_thread->userprog_vaddr.vaddr_start) / PAGE_SIZE;
-    while (cnt < pg_cnt) {
-      bitmap_set(&cur_thread->userprog_vaddr.vaddr_bitmap,
-                 allocated_bit_idx_start + cnt++, 0);
-    }
+    vma_remove(running_thread(), vaddr, pg_cnt * PAGE_SIZE);
   }
 }
 
@@ -727,7 +2090,8 @@ static void vaddr_remove(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt) {
  * given virtual address. It translates the virtual address to a physical
  * address and ensures it falls within the correct memory pool. The function
  * then recycles each physical page and removes the corresponding virtual
- * address mapping.
+ * address mapping. The swap slot of a page that is swapped out is freed
+ * instead.
  *
  * Context: Integral for memory management, specifically for freeing a block of
  *          physical memory and its associated virtual mappings.
@@ -736,42 +2100,70 @@ void mfree_page(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt) {
   uint32_t vaddr = (uint32_t)_vaddr;
   uint32_t cnt = 0;
   ASSERT(pg_cnt >= 1 && vaddr % PAGE_SIZE == 0);
-  uint32_t page_phy_addr = addr_v2p(vaddr);
-
-  /* Exclude low-end 1MB kernel, 1KB page directory table, and 1KB page table,
-   * that is, 0x100000+0x001000+0x001000=102000
-   */
-  ASSERT((page_phy_addr % PAGE_SIZE) == 0 && page_phy_addr >= 0x102000);
-
-  /* user_pool or kernel_pool */
-  if (page_phy_addr >= user_pool.phy_addr_start) {
-    while (cnt < pg_cnt) {
-      page_phy_addr = addr_v2p(vaddr);
-      ASSERT((page_phy_addr % PAGE_SIZE) == 0 &&
-             page_phy_addr >= user_pool.phy_addr_start);
-      pfree(page_phy_addr);
-      page_table_pte_remove(vaddr);
-      vaddr += PAGE_SIZE;
-
-      cnt++;
-    }
-  } else {
-    while (cnt < pg_cnt) {
-      page_phy_addr = addr_v2p(vaddr);
-      ASSERT((page_phy_addr % PAGE_SIZE) == 0 &&
-             page_phy_addr >= kernel_pool.phy_addr_start &&
-             page_phy_addr < user_pool.phy_addr_start);
-
+  ALLOC_TRACE_DEL(_vaddr);
+
+  while (cnt < pg_cnt) {
+    /* the page must not be swapped out between the check and the free */
+    enum intr_status old_status = intr_disable();
+    /* user pages reserved but never touched have no page frame yet */
+    if (page_swapped(vaddr)) {
+      swap_slot_free(*pte_ptr(vaddr) >> 12);
+      *pte_ptr(vaddr) = 0;
+    } else if (page_mapped(vaddr)) {
+      phys_addr_t page_phy_addr = addr_v2p(vaddr);
+      /* Exclude low-end 1MB kernel, 1KB page directory table, and 1KB page
+       * table, that is, 0x100000+0x001000+0x001000=102000 */
+      ASSERT((page_phy_addr % PAGE_SIZE) == 0 && page_phy_addr >= 0x102000);
+
+      /* user_pool or kernel_pool */
+      if (pf == PF_USER) {
+        ASSERT(page_phy_addr >= user_pool.phy_addr_start);
+      } else {
+        ASSERT(page_phy_addr >= kernel_pool.phy_addr_start &&
+               page_phy_addr < user_pool.phy_addr_start);
+      }
       pfree(page_phy_addr);
       page_table_pte_remove(vaddr);
-      vaddr += PAGE_SIZE;
-
-      cnt++;
     }
+    intr_set_status(old_status);
+    vaddr += PAGE_SIZE;
+    cnt++;
   }
   vaddr_remove(pf, _vaddr, pg_cnt);
 }
 
+/**
+ * sys_brk() - Move the end of the heap of the process.
+ * @new_brk: The new end of the heap, or 0 to query it.
+ *
+ * The heap is one region from USER_BRK_START up to the break rounded up to a
+ * page. Growing it only extends the region, its pages are zero-filled on the
+ * first touch like any anonymous memory. Shrinking it frees the pages above
+ * the new break. exec keeps the break, like the rest of the old image.
+ *
+ * Return: The new break, or the current one if 'new_brk' is 0, outside the
+ * user space above USER_BRK_START, or the range above the heap is already in
+ * use.
+ */
+uint32_t sys_brk(uint32_t new_brk) {
+  struct task_struct *cur = running_thread();
+  if (cur->pg_dir == NULL)
+    return 0;
+  if (new_brk < USER_BRK_START || new_brk > 0xc0000000)
+    return cur->brk;
+
+  uint32_t old_end = DIV_ROUND_UP(cur->brk, PAGE_SIZE) * PAGE_SIZE;
+  uint32_t new_end = DIV_ROUND_UP(new_brk, PAGE_SIZE) * PAGE_SIZE;
+  if (new_end > old_end) {
+    if (!vma_insert(cur, old_end, new_end - old_end, VM_READ | VM_WRITE))
+      return cur->brk;
+  } else if (new_end < old_end) {
+    mfree_page(PF_USER, (void *)new_end, (old_end - new_end) / PAGE_SIZE);
+  }
+  cur->brk = new_brk;
+  return new_brk;
+}
+
 /**
  * sys_free() - Free memory at a given pointer.
  * @ptr: Pointer to the memory to be freed.
@@ -793,8 +2185,9 @@ void sys_free(void *ptr) {
     return;
   enum pool_flags pf;
   struct pool *mem_pool;
+  struct task_struct *cur_thread = running_thread();
 
-  if (running_thread()->pg_dir == NULL) {
+  if (cur_thread->pg_dir == NULL) {
     ASSERT((uint32_t)ptr >= KERNEL_HEAP_START);
     pf = PF_KERNEL;
     mem_pool = &kernel_pool;
@@ -802,29 +2195,30 @@ void sys_free(void *ptr) {
     pf = PF_USER;
     mem_pool = &user_pool;
   }
-  lock_acquire(&mem_pool->_lock);
 
   struct mem_block *b = ptr;
   struct arena *a = block_2_arena(b);
   if (a->desc == NULL && a->large_mb == true) {
     /* large memory blocks larger than 1024 bytes  */
+    lock_acquire(&mem_pool->_lock);
     mfree_page(pf, a, a->cnt);
+    lock_release(&mem_pool->_lock);
   } else {
-    /* small memory blocks divided within a page  */
-    list_append(&a->desc->free_list, &b->free_elem);
-
-    /* the whole page is unused, free it  */
-    if (++a->cnt == a->desc->block_per_arena) {
-      uint32_t block_idx;
-      for (block_idx = 0; block_idx < a->desc->block_per_arena; block_idx++) {
-        struct mem_block *b = arena_2_block(a, block_idx);
-        ASSERT(list_elem_find(&a->desc->free_list, &b->free_elem));
-        list_remove(&b->free_elem);
-      }
-      mfree_page(pf, a, 1);
+    /* small memory blocks divided within a page, keep it in the magazine of
+     * its size class. A full magazine gives half of its blocks back first  */
+    ALLOC_TRACE_DEL(ptr);
+    uint8_t desc_idx = 0;
+    while ((16 << desc_idx) < a->desc->block_size)
+      desc_idx++;
+    struct mem_magazine *mag = &cur_thread->mb_mag_arr[desc_idx];
+    if (mag->cnt < MAG_SIZE) {
+      mag->free_hit++;
+    } else {
+      mag->free_miss++;
+      mag_flush(mem_pool, pf, mag, MAG_BATCH);
     }
+    mag_push(mag, b);
   }
-  lock_release(&mem_pool->_lock);
 }
 
 /**
@@ -850,8 +2244,8 @@ void *get_page_to_vaddr_without_bitmap(enum pool_flags pf, uint32_t vaddr) {
   struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
   lock_acquire(&mem_pool->_lock);
 
-  void *page_phy_addr = palloc(mem_pool);
-  if (page_phy_addr == NULL) {
+  phys_addr_t page_phy_addr = palloc(mem_pool);
+  if (page_phy_addr == 0) {
     lock_release(&mem_pool->_lock);
     return NULL;
   }
@@ -859,3 +2253,282 @@ void *get_page_to_vaddr_without_bitmap(enum pool_flags pf, uint32_t vaddr) {
   lock_release(&mem_pool->_lock);
   return (void *)vaddr;
 }
+
+/* append 'val' to 'line', padded with spaces to 'width' characters */
+static void meminfo_cell(char *line, uint32_t val, uint32_t width) {
+  char *cell = line + strlen(line);
+  uint32_t len = sprintf(cell, "%d", val);
+  while (len < width) {
+    cell[len++] = ' ';
+  }
+  cell[len] = 0;
+}
+
+/* print one line of the pool table: total, free, used and largest run  */
+static void meminfo_pool(const char *name, uint32_t total, uint32_t free,
+                         uint32_t largest) {
+  char line[80];
+  strcpy(line, name);
+  meminfo_cell(line, total, 10);
+  meminfo_cell(line, free, 10);
+  meminfo_cell(line, total - free, 10);
+  meminfo_cell(line, largest, 10);
+  strcat(line, "\n");
+  sys_write(STDOUT_NO, line, strlen(line));
+}
+
+/* the frames of a pool given to the buddy allocator, holes left out  */
+static uint32_t pool_usable_pages(struct pool *mem_pool) {
+  return (uint32_t)(mem_pool->pool_size >> 12);
+}
+
+/* free pages of a pool and the size of its largest free buddy block */
+static void pool_stat(struct pool *mem_pool, uint32_t *free,
+                      uint32_t *largest) {
+  enum intr_status old_status = intr_disable();
+  *free = mem_pool->free_cnt + mem_pool->zeroed_cnt;
+  *largest = mem_pool->zeroed_cnt > 0 ? 1 : 0;
+  int32_t order;
+  for (order = BUDDY_MAX_ORDER; order >= 0; order--) {
+    if (!list_empty(&mem_pool->free_area[order])) {
+      *largest = 1 << order;
+      break;
+    }
+  }
+  intr_set_status(old_status);
+}
+
+/* free pages of the kernel virtual address space and its longest free run */
+static void kernel_vaddr_stat(uint32_t *total, uint32_t *free,
+                              uint32_t *largest) {
+  struct bitmap *btmp = &kernel_vaddr.vaddr_bitmap;
+  uint32_t bit_idx, run = 0;
+  *total = btmp->bmap_bytes_len * 8;
+  *free = *largest = 0;
+  enum intr_status old_status = intr_disable();
+  for (bit_idx = 0; bit_idx < *total; bit_idx++) {
+    if (bitmap_bit_test(btmp, bit_idx)) {
+      run = 0;
+      continue;
+    }
+    (*free)++;
+    if (++run > *largest)
+      *largest = run;
+  }
+  intr_set_status(old_status);
+}
+
+/**
+ * task_pages() - Count the user pages of a process in memory and in swap.
+ * @pthread: The process, which need not be the running one.
+ * @resident: Set to the number of present pages, shared ones included.
+ * @swapped: Set to the number of pages in the swap area.
+ *
+ * The page tables of the process are read through kmap(), so the address
+ * space is not switched.
+ */
+static void task_pages(struct task_struct *pthread, uint32_t *resident,
+                       uint32_t *swapped) {
+  uint32_t pde_idx, pte_idx;
+  *resident = *swapped = 0;
+  for (pde_idx = 0; pde_idx < 0xc0000000 / PT_SPAN; pde_idx++) {
+    enum intr_status old_status = intr_disable();
+    pte_t pde = pthread->pg_dir[pde_idx];
+    if (!(pde & PG_P_1)) {
+      intr_set_status(old_status);
+      continue;
+    }
+    pte_t *pt = kmap(pde & PG_FRAME);
+    for (pte_idx = 0; pte_idx < PAGE_SIZE / sizeof(pte_t); pte_idx++) {
+      if (pt[pte_idx] & PG_P_1)
+        (*resident)++;
+      else if (pt[pte_idx] & PG_SWAP)
+        (*swapped)++;
+    }
+    kunmap(pt);
+    intr_set_status(old_status);
+  }
+}
+
+/**
+ * struct task_mem - The memory of one task, as printed by sys_meminfo().
+ * @pid: The pid of the task.
+ * @resident: Present user pages, shared ones included.
+ * @swapped: User pages in the swap area.
+ * @arenas: Arenas of the user size classes.
+ * @user: False for a kernel thread, which has no user pages.
+ * @name: The name of the task.
+ */
+struct task_mem {
+  pid_t pid;
+  uint32_t resident;
+  uint32_t swapped;
+  uint32_t arenas;
+  bool user;
+  char name[TASK_NAME_LEN];
+};
+
+/* the entries of struct task_mem one page holds, and how many are filled */
+struct task_mem_buf {
+  struct task_mem *entries;
+  uint32_t cnt;
+};
+#define TASK_MEM_MAX (PAGE_SIZE / sizeof(struct task_mem))
+
+static bool meminfo_task(struct list_elem *pelem, int arg) {
+  struct task_struct *pthread =
+      elem2entry(struct task_struct, all_list_tag, pelem);
+  struct task_mem_buf *buf = (struct task_mem_buf *)arg;
+  if (buf->cnt == TASK_MEM_MAX)
+    return true;
+  struct task_mem *tm = &buf->entries[buf->cnt++];
+  tm->pid = pthread->pid;
+  tm->user = pthread->pg_dir != NULL;
+  strcpy(tm->name, pthread->name);
+  if (tm->user) {
+    uint32_t desc_idx;
+    task_pages(pthread, &tm->resident, &tm->swapped);
+    tm->arenas = 0;
+    for (desc_idx = 0; desc_idx < MB_DESC_CNT; desc_idx++) {
+      tm->arenas += pthread->u_mb_desc_arr[desc_idx].arena_cnt;
+    }
+  }
+  return false;
+}
+
+/**
+ * meminfo_tasks() - Print the memory of every task.
+ *
+ * The numbers of all tasks are collected into a page with interrupts
+ * disabled, so no task comes or goes during the walk, and are printed once
+ * the walk is over.
+ */
+static void meminfo_tasks(void) {
+  char *title = "PID   RSS     SWAP    ARENAS  COMMAND\n";
+  sys_write(STDOUT_NO, title, strlen(title));
+  struct task_mem_buf buf = {get_kernel_pages(1), 0};
+  if (buf.entries == NULL)
+    return;
+  enum intr_status old_status = intr_disable();
+  list_traversal(&thread_all_list, meminfo_task, (int)&buf);
+  intr_set_status(old_status);
+
+  uint32_t idx;
+  for (idx = 0; idx < buf.cnt; idx++) {
+    struct task_mem *tm = &buf.entries[idx];
+    char line[80] = {0};
+    meminfo_cell(line, tm->pid, 6);
+    if (!tm->user) {
+      /* kernel threads only own their PCB, and use the kernel size classes */
+      strcat(line, "-       -       -       ");
+    } else {
+      meminfo_cell(line, tm->resident, 8);
+      meminfo_cell(line, tm->swapped, 8);
+      meminfo_cell(line, tm->arenas, 8);
+    }
+    strcat(line, tm->name);
+    strcat(line, "\n");
+    sys_write(STDOUT_NO, line, strlen(line));
+  }
+  free_kernel_pages(buf.entries, 1);
+}
+
+/* the blocks of one kernel size class held by the magazines of threads  */
+struct mag_count {
+  uint32_t desc_idx;
+  uint32_t cnt;
+};
+
+static bool meminfo_mag_cnt(struct list_elem *pelem, int arg) {
+  struct task_struct *pthread =
+      elem2entry(struct task_struct, all_list_tag, pelem);
+  struct mag_count *mc = (struct mag_count *)arg;
+  if (pthread->pg_dir == NULL)
+    mc->cnt += pthread->mb_mag_arr[mc->desc_idx].cnt;
+  return false;
+}
+
+/**
+ * meminfo_slab() - Print the statistics of every object cache.
+ *
+ * The counters of a cache are copied with interrupts disabled and printed
+ * afterwards. Caches are never destroyed, so the list can be followed across
+ * the writes.
+ */
+static void meminfo_slab(void) {
+  char *title = "CACHE       SIZE    SLABS   INUSE   ALLOCS    FREES     GROWS\n";
+  sys_write(STDOUT_NO, title, strlen(title));
+  struct list_elem *elem = kmem_cache_list.head.next;
+  while (elem != &kmem_cache_list.tail) {
+    enum intr_status old_status = intr_disable();
+    struct kmem_cache cache =
+        *elem2entry(struct kmem_cache, cache_tag, elem);
+    elem = elem->next;
+    intr_set_status(old_status);
+
+    char line[80];
+    uint32_t len = strlen(cache.name);
+    strcpy(line, cache.name);
+    while (len < 12) {
+      line[len++] = ' ';
+    }
+    line[len] = 0;
+    meminfo_cell(line, cache.obj_size, 8);
+    meminfo_cell(line, cache.slab_cnt, 8);
+    meminfo_cell(line, cache.obj_inuse, 8);
+    meminfo_cell(line, cache.alloc_cnt, 10);
+    meminfo_cell(line, cache.free_cnt, 10);
+    meminfo_cell(line, cache.grow_cnt, 0);
+    strcat(line, "\n");
+    sys_write(STDOUT_NO, line, strlen(line));
+  }
+}
+
+/**
+ * sys_meminfo() - Print the usage of memory.
+ *
+ * Prints, in pages, the size, free and used part and the largest free block
+ * of the kernel pool, the user pool and the kernel virtual address space,
+ * where the size of a pool only counts the frames outside e820 holes,
+ * then the arenas and free blocks of each kernel size class, where blocks
+ * held by the magazines of kernel threads are counted apart, the slabs,
+ * objects and counters of each object cache, and the resident and swapped
+ * pages and the arenas of the size classes of each process. The numbers are
+ * snapshots taken one table at a time.
+ */
+void sys_meminfo(void) {
+  char line[80];
+  uint32_t total, free, largest;
+  char *title = "          TOTAL     FREE      USED      LARGEST\n";
+  sys_write(STDOUT_NO, title, strlen(title));
+  pool_stat(&kernel_pool, &free, &largest);
+  meminfo_pool("kernel    ", pool_usable_pages(&kernel_pool), free, largest);
+  pool_stat(&user_pool, &free, &largest);
+  meminfo_pool("user      ", pool_usable_pages(&user_pool), free, largest);
+  kernel_vaddr_stat(&total, &free, &largest);
+  meminfo_pool("kvaddr    ", total, free, largest);
+  sprintf(line, "zero page: %d  page cache: %d  swap: %d/%d\n",
+          zero_page_saved, page_cache_pages, swap_slot_used, swap_slot_cnt);
+  sys_write(STDOUT_NO, line, strlen(line));
+
+  title = "SIZE    ARENAS  FREE    CACHED\n";
+  sys_write(STDOUT_NO, title, strlen(title));
+  uint32_t desc_idx;
+  for (desc_idx = 0; desc_idx < MB_DESC_CNT; desc_idx++) {
+    struct mem_block_desc *desc = &k_mb_desc_arr[desc_idx];
+    struct mag_count mc = {desc_idx, 0};
+    enum intr_status old_status = intr_disable();
+    uint32_t arenas = desc->arena_cnt, free_blocks = list_len(&desc->free_list);
+    list_traversal(&thread_all_list, meminfo_mag_cnt, (int)&mc);
+    intr_set_status(old_status);
+    line[0] = 0;
+    meminfo_cell(line, desc->block_size, 8);
+    meminfo_cell(line, arenas, 8);
+    meminfo_cell(line, free_blocks, 8);
+    meminfo_cell(line, mc.cnt, 0);
+    strcat(line, "\n");
+    sys_write(STDOUT_NO, line, strlen(line));
+  }
+  meminfo_slab();
+  meminfo_tasks();
+}
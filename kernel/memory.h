@@ -9,12 +9,46 @@
 #include "list.h"
 #include "stdint.h"
 
+struct task_struct;
+
+#ifdef PAE
+/* PAE paging ('make PAE=1'): three levels with 64-bit entries, so frames may
+ * lie above 4GB */
+typedef uint64_t pte_t;
+typedef uint64_t phys_addr_t;
+/* the frame bits of an entry, 12-51 */
+#define PG_FRAME 0x000ffffffffff000ULL
+/* bit 63: instructions are never fetched from the page (needs EFER.NXE) */
+#define PG_NX 0x8000000000000000ULL
+/* bytes of address space mapped by one page table */
+#define PT_SPAN 0x200000
+#else
+typedef uint32_t pte_t;
+typedef uint32_t phys_addr_t;
+#define PG_FRAME 0xfffff000
+/* there is no NX bit without PAE */
+#define PG_NX 0
+#define PT_SPAN 0x400000
+#endif
+
 #define PG_P_1 1
 #define PG_P_0 0
 #define PG_RW_R 0
 #define PG_RW_W 2
 #define PG_US_S 0
 #define PG_US_U 4
+/* global page, not flushed from TLB by the reload of CR3 (CR4.PGE is set) */
+#define PG_G 0x100
+/* bit 9 of PTE (available to software): read-only until written, then copied
+ * by the page fault handler */
+#define PG_COW 0x200
+/* set by the CPU when the page is accessed */
+#define PG_A 0x20
+/* set by the CPU when the page is written */
+#define PG_D 0x40
+/* bit 10 of a non-present PTE: the page is in the swap area, in the slot
+ * given by bits 12-31 */
+#define PG_SWAP 0x400
 
 #define MB_DESC_CNT 7
 
@@ -52,6 +86,7 @@ struct mem_block {
  * @block_size: Size of each memory block.
  * @blocks_per_arena: Number of blocks that this arena can hold.
  * @free_list: List of currently available memory blocks.
+ * @arena_cnt: Number of arenas of this size class.
  *
  * This structure is used to describe properties of memory blocks, including
  * their size, the number of blocks per arena, and a list of free blocks.
@@ -60,18 +95,68 @@ struct mem_block_desc {
   uint32_t block_size;
   uint32_t block_per_arena;
   struct list free_list;
+  uint32_t arena_cnt;
+};
+
+/* blocks a magazine holds at most, and blocks moved by one refill or flush */
+#define MAG_SIZE 16
+#define MAG_BATCH 8
+
+/**
+ * struct mem_magazine - Per-task cache of free blocks of one size class.
+ * @top: The last pushed free block, blocks are chained by free_elem.next.
+ * @cnt: The number of blocks in the magazine.
+ * @alloc_hit: Allocations served by the magazine.
+ * @alloc_miss: Allocations that found it empty and refilled it.
+ * @free_hit: Frees kept in the magazine.
+ * @free_miss: Frees that found it full and flushed part of it.
+ *
+ * Every task has one magazine for each memory block descriptor, so that the
+ * common sys_malloc()/sys_free() path never takes the lock of the pool. The
+ * blocks in a magazine are still allocated as far as their arena is
+ * concerned.
+ */
+struct mem_magazine {
+  struct list_elem *top;
+  uint32_t cnt;
+  uint32_t alloc_hit;
+  uint32_t alloc_miss;
+  uint32_t free_hit;
+  uint32_t free_miss;
 };
 
 extern struct pool kernel_pool, user_pool;
+extern uint32_t zero_page_saved;
 void mem_init();
+void *malloc_page(enum pool_flags pf, uint32_t pg_cnt);
 void *get_kernel_pages(uint32_t pg_cnt);
+void free_kernel_pages(void *vaddr, uint32_t pg_cnt);
 void *get_a_page(enum pool_flags pf, uint32_t vaddr);
-uint32_t addr_v2p(uint32_t vaddr);
+phys_addr_t addr_v2p(uint32_t vaddr);
+bool page_mapped(uint32_t vaddr);
+pte_t page_cow_share(uint32_t vaddr);
+pte_t page_share(uint32_t vaddr);
+void page_map_in(struct task_struct *pthread, uint32_t vaddr, pte_t pte);
+void *kmap(phys_addr_t page_phy_addr);
+void kunmap(void *vaddr);
+void page_cow_map(uint32_t vaddr, phys_addr_t page_phy_addr);
+void page_share_map(uint32_t vaddr, phys_addr_t page_phy_addr);
+void page_set_prot(uint32_t vaddr, bool writable);
+void page_set_exec(uint32_t vaddr, bool executable);
+phys_addr_t frame_alloc_zeroed(enum pool_flags pf);
+uint32_t pool_free_pages(enum pool_flags pf);
+uint32_t page_reclaim(uint32_t target);
+bool page_swapped(uint32_t vaddr);
+pte_t page_swap_share(uint32_t vaddr);
+void pfree(phys_addr_t page_phy_addr);
 void block_desc_init(struct mem_block_desc *k_mb_desc_arr);
 void *sys_malloc(uint32_t _size);
 void sys_free(void *ptr);
 void *get_page_to_vaddr_without_bitmap(enum pool_flags pf, uint32_t vaddr);
+bool zeroed_page_refill(void);
 void mfree_page(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt);
-uint32_t *pte_ptr(uint32_t vaddr);
-uint32_t *pde_ptr(uint32_t vaddr);
+uint32_t sys_brk(uint32_t new_brk);
+void sys_meminfo(void);
+pte_t *pte_ptr(uint32_t vaddr);
+pte_t *pde_ptr(uint32_t vaddr);
 #endif
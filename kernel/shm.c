@@ -0,0 +1,195 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-27
+ */
+#include "shm.h"
+#include "debug.h"
+#include "global.h"
+#include "memory.h"
+#include "print.h"
+#include "stdint.h"
+#include "sync.h"
+#include "thread.h"
+#include "vma.h"
+
+/**
+ * struct shm_segment - A shared memory segment.
+ * @key: The key the segment was created with.
+ * @pg_cnt: The number of pages in the segment, 0 if the slot is unused.
+ * @frames: Physical addresses of the page frames of the segment, in a kernel
+ * page.
+ *
+ * The segment owns one reference to each of its frames, and every process
+ * that attaches it maps the frames as one more sharer (see page_share_map()).
+ * Removing the segment drops its own references, so the frames live on until
+ * the last process detaches them, even though the key is gone.
+ */
+struct shm_segment {
+  int32_t key;
+  uint32_t pg_cnt;
+  phys_addr_t *frames;
+};
+
+static struct shm_segment shm_table[MAX_SHM_SEGMENTS];
+static struct lock shm_lock;
+
+/**
+ * shm_init() - Initialize the table of shared memory segments.
+ */
+void shm_init(void) {
+  put_str("shm_init start\n");
+  lock_init(&shm_lock);
+  put_str("shm_init done\n");
+}
+
+/* drop the references of a segment to its frames and free the slot */
+static void shm_release(struct shm_segment *seg, uint32_t pg_cnt) {
+  uint32_t pg_idx;
+  for (pg_idx = 0; pg_idx < pg_cnt; pg_idx++) {
+    pfree(seg->frames[pg_idx]);
+  }
+  free_kernel_pages(seg->frames, 1);
+  seg->pg_cnt = 0;
+}
+
+/**
+ * sys_shmget() - Get the shared memory segment of a key, creating it if
+ * needed.
+ * @key: Key agreed upon by the processes sharing the segment.
+ * @size: The size of the segment in bytes.
+ *
+ * A new segment is zero-filled, its frames are allocated at once.
+ *
+ * Return: The id of the segment, or -1 if an existing segment is smaller than
+ * 'size', the size is out of range, or the table or the memory is exhausted.
+ */
+int32_t sys_shmget(int32_t key, uint32_t size) {
+  if (size == 0 || size > SHM_MAX_PAGES * PAGE_SIZE)
+    return -1;
+  uint32_t pg_cnt = DIV_ROUND_UP(size, PAGE_SIZE);
+
+  lock_acquire(&shm_lock);
+  int32_t free_id = -1;
+  int32_t shm_id;
+  for (shm_id = 0; shm_id < MAX_SHM_SEGMENTS; shm_id++) {
+    struct shm_segment *seg = &shm_table[shm_id];
+    if (seg->pg_cnt == 0) {
+      if (free_id == -1)
+        free_id = shm_id;
+    } else if (seg->key == key) {
+      lock_release(&shm_lock);
+      return pg_cnt <= seg->pg_cnt ? shm_id : -1;
+    }
+  }
+  if (free_id == -1) {
+    lock_release(&shm_lock);
+    return -1;
+  }
+
+  struct shm_segment *seg = &shm_table[free_id];
+  seg->frames = get_kernel_pages(1);
+  if (seg->frames == NULL) {
+    lock_release(&shm_lock);
+    return -1;
+  }
+  uint32_t pg_idx;
+  for (pg_idx = 0; pg_idx < pg_cnt; pg_idx++) {
+    seg->frames[pg_idx] = frame_alloc_zeroed(PF_USER);
+    if (seg->frames[pg_idx] == 0) {
+      shm_release(seg, pg_idx);
+      lock_release(&shm_lock);
+      return -1;
+    }
+  }
+  seg->key = key;
+  seg->pg_cnt = pg_cnt;
+  lock_release(&shm_lock);
+  return free_id;
+}
+
+/**
+ * sys_shmat() - Attach a shared memory segment to the current process.
+ * @shm_id: The id returned by sys_shmget().
+ * @addr: The page aligned address to attach at, or NULL to let the kernel
+ * choose.
+ *
+ * All frames are mapped right away, writable by every process attaching the
+ * segment. A child created by fork shares the attachment, not a copy.
+ *
+ * Return: The address of the segment, or NULL on failure.
+ */
+void *sys_shmat(int32_t shm_id, void *addr) {
+  struct task_struct *cur = running_thread();
+  if (cur->pg_dir == NULL || shm_id < 0 || shm_id >= MAX_SHM_SEGMENTS ||
+      (uint32_t)addr % PAGE_SIZE != 0)
+    return NULL;
+
+  lock_acquire(&shm_lock);
+  struct shm_segment *seg = &shm_table[shm_id];
+  if (seg->pg_cnt == 0) {
+    lock_release(&shm_lock);
+    return NULL;
+  }
+  uint32_t len = seg->pg_cnt * PAGE_SIZE;
+  uint32_t flags = VM_READ | VM_WRITE | VM_SHARED;
+  uint32_t vaddr = (uint32_t)addr;
+  if (vaddr == 0) {
+    vaddr = vma_alloc(cur, len, flags);
+  } else if (!vma_insert(cur, vaddr, len, flags)) {
+    vaddr = 0;
+  }
+  if (vaddr != 0) {
+    uint32_t pg_idx;
+    for (pg_idx = 0; pg_idx < seg->pg_cnt; pg_idx++) {
+      page_share_map(vaddr + pg_idx * PAGE_SIZE, seg->frames[pg_idx]);
+    }
+  }
+  lock_release(&shm_lock);
+  return (void *)vaddr;
+}
+
+/**
+ * sys_shmdt() - Detach a shared memory segment from the current process.
+ * @addr: The address returned by sys_shmat().
+ *
+ * The region attached at 'addr' tells the size, so a segment removed in the
+ * meantime is detached the same way.
+ *
+ * Return: 0 on success, -1 if no segment is attached at 'addr'. A file
+ * mapping is VM_SHARED too, but only sys_munmap() removes it, after writing
+ * its dirty pages back.
+ */
+int32_t sys_shmdt(void *addr) {
+  struct task_struct *cur = running_thread();
+  if (cur->pg_dir == NULL)
+    return -1;
+  struct vm_area *vma = vma_find(cur, (uint32_t)addr);
+  if (vma == NULL || !(vma->flags & VM_SHARED) || (vma->flags & VM_FILE) ||
+      vma->start != (uint32_t)addr)
+    return -1;
+  mfree_page(PF_USER, addr, (vma->end - vma->start) / PAGE_SIZE);
+  return 0;
+}
+
+/**
+ * sys_shmrm() - Remove a shared memory segment.
+ * @shm_id: The id returned by sys_shmget().
+ *
+ * The key can be used for a new segment at once. Processes that have the
+ * segment attached keep using its frames until they detach it.
+ *
+ * Return: 0 on success, -1 if there is no such segment.
+ */
+int32_t sys_shmrm(int32_t shm_id) {
+  if (shm_id < 0 || shm_id >= MAX_SHM_SEGMENTS)
+    return -1;
+  lock_acquire(&shm_lock);
+  struct shm_segment *seg = &shm_table[shm_id];
+  if (seg->pg_cnt == 0) {
+    lock_release(&shm_lock);
+    return -1;
+  }
+  shm_release(seg, seg->pg_cnt);
+  lock_release(&shm_lock);
+  return 0;
+}
@@ -0,0 +1,22 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-27
+ */
+#ifndef __KERNEL_SHM_H
+#define __KERNEL_SHM_H
+#include "global.h"
+#include "memory.h"
+#include "stdint.h"
+
+/* number of shared memory segments in the system */
+#define MAX_SHM_SEGMENTS 16
+/* a segment is described by one page of frame addresses, that is, 4MB (2MB
+ * with PAE) */
+#define SHM_MAX_PAGES (PAGE_SIZE / sizeof(phys_addr_t))
+
+void shm_init(void);
+int32_t sys_shmget(int32_t key, uint32_t size);
+void *sys_shmat(int32_t shm_id, void *addr);
+int32_t sys_shmdt(void *addr);
+int32_t sys_shmrm(int32_t shm_id);
+#endif
@@ -0,0 +1,206 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-20
+ */
+#include "slab.h"
+#include "debug.h"
+#include "global.h"
+#include "interrupt.h"
+#include "list.h"
+#include "memory.h"
+#include "stdint.h"
+#include "string.h"
+
+/* number of completely free slabs a cache keeps before returning pages */
+#define SLAB_FREE_KEEP 1
+
+/**
+ * struct slab - Metadata at the beginning of every slab.
+ * @cache: The cache owning this slab.
+ * @slab_tag: Element in one of the slab lists of the cache.
+ * @inuse: Number of allocated objects in this slab.
+ * @free_top: Number of valid entries in 'free_stack'.
+ * @objs: Address of the first object.
+ * @free_stack: Indexes of the free objects, followed in the page by the
+ * objects themselves.
+ *
+ * Free objects are tracked by index instead of by a link written into the
+ * object, so that a free object keeps the state its constructor gave it.
+ */
+struct slab {
+  struct kmem_cache *cache;
+  struct list_elem slab_tag;
+  uint32_t inuse;
+  uint32_t free_top;
+  uint8_t *objs;
+  uint16_t free_stack[0];
+};
+
+struct list kmem_cache_list;
+
+/* the space taken by the slab header and free stack for 'obj_cnt' objects */
+static uint32_t slab_header_size(uint32_t obj_cnt) {
+  return (sizeof(struct slab) + obj_cnt * sizeof(uint16_t) + 7) & ~7;
+}
+
+/**
+ * kmem_cache_init() - Initialize an object cache.
+ * @cache: The cache to initialize.
+ * @name: Name of the cache.
+ * @obj_size: Size of the objects, which must fit in one page with the slab
+ * header.
+ * @ctor: Constructor of the objects, or NULL if objects need no construction.
+ *
+ * The cache starts empty, slabs are created on the first allocation.
+ */
+void kmem_cache_init(struct kmem_cache *cache, char *name, uint32_t obj_size,
+                     kmem_ctor *ctor) {
+  memset(cache, 0, sizeof(struct kmem_cache));
+  ASSERT(strlen(name) < KMEM_CACHE_NAME_LEN);
+  strcpy(cache->name, name);
+  cache->obj_size = (obj_size + 3) & ~3;
+  cache->ctor = ctor;
+
+  /* as many objects as a page can hold after the header  */
+  uint32_t obj_cnt = PAGE_SIZE / cache->obj_size;
+  while (obj_cnt > 0 &&
+         slab_header_size(obj_cnt) + obj_cnt * cache->obj_size > PAGE_SIZE) {
+    obj_cnt--;
+  }
+  ASSERT(obj_cnt > 0);
+  cache->obj_per_slab = obj_cnt;
+
+  list_init(&cache->slabs_partial);
+  list_init(&cache->slabs_full);
+  list_init(&cache->slabs_free);
+
+  enum intr_status old_status = intr_disable();
+  list_append(&kmem_cache_list, &cache->cache_tag);
+  intr_set_status(old_status);
+}
+
+/**
+ * kmem_cache_grow() - Make a new slab for a cache.
+ * @cache: The cache to grow.
+ *
+ * A kernel page is allocated by get_kernel_pages(), under the lock of the
+ * kernel pool, its header and free stack are set up, and every object in it
+ * is constructed. The slab is not put on a list of the cache yet.
+ *
+ * Context: May wait for the lock of the pool, so the slab lists must not be
+ * in the middle of an update.
+ *
+ * Return: The new slab, or NULL if no kernel page is available.
+ */
+static struct slab *kmem_cache_grow(struct kmem_cache *cache) {
+  struct slab *slab = get_kernel_pages(1);
+  if (slab == NULL)
+    return NULL;
+  slab->cache = cache;
+  slab->inuse = 0;
+  slab->objs = (uint8_t *)slab + slab_header_size(cache->obj_per_slab);
+  slab->free_top = cache->obj_per_slab;
+
+  uint32_t obj_idx;
+  for (obj_idx = 0; obj_idx < cache->obj_per_slab; obj_idx++) {
+    /* hand out low addresses first */
+    slab->free_stack[obj_idx] = cache->obj_per_slab - 1 - obj_idx;
+    if (cache->ctor != NULL)
+      cache->ctor(slab->objs + obj_idx * cache->obj_size);
+  }
+  return slab;
+}
+
+/* a slab of 'cache' with a free object taken off its list, or NULL  */
+static struct slab *kmem_cache_take(struct kmem_cache *cache) {
+  if (!list_empty(&cache->slabs_partial))
+    return elem2entry(struct slab, slab_tag, list_pop(&cache->slabs_partial));
+  if (!list_empty(&cache->slabs_free))
+    return elem2entry(struct slab, slab_tag, list_pop(&cache->slabs_free));
+  return NULL;
+}
+
+/**
+ * kmem_cache_alloc() - Allocate an object from a cache.
+ * @cache: The cache to allocate from.
+ *
+ * Partially used slabs are preferred, then completely free ones, and a new slab
+ * is created only when the cache has no free object at all. The slab lists
+ * are only touched with interrupts disabled, but the page of a new slab is
+ * allocated with them enabled, so the lists are checked again afterwards: if
+ * another task gave objects back meanwhile, those are used and the new slab
+ * is kept as a free one.
+ *
+ * Return: A constructed object, or NULL if the cache can not grow.
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+  enum intr_status old_status = intr_disable();
+  struct slab *slab = kmem_cache_take(cache);
+  if (slab == NULL) {
+    intr_set_status(old_status);
+    struct slab *new_slab = kmem_cache_grow(cache);
+    if (new_slab == NULL)
+      return NULL;
+    old_status = intr_disable();
+    cache->slab_cnt++;
+    cache->grow_cnt++;
+    slab = kmem_cache_take(cache);
+    if (slab == NULL)
+      slab = new_slab;
+    else
+      list_push(&cache->slabs_free, &new_slab->slab_tag);
+  }
+
+  ASSERT(slab->free_top > 0);
+  uint16_t obj_idx = slab->free_stack[--slab->free_top];
+  slab->inuse++;
+  if (slab->free_top == 0) {
+    list_push(&cache->slabs_full, &slab->slab_tag);
+  } else {
+    list_push(&cache->slabs_partial, &slab->slab_tag);
+  }
+  cache->obj_inuse++;
+  cache->alloc_cnt++;
+  intr_set_status(old_status);
+  return slab->objs + obj_idx * cache->obj_size;
+}
+
+/**
+ * kmem_cache_free() - Give an object back to its cache.
+ * @cache: The cache the object was allocated from.
+ * @obj: The object, which must be in its constructed state.
+ *
+ * When the slab of the object becomes completely free, it is kept for reuse
+ * unless the cache already holds SLAB_FREE_KEEP free slabs, in which case its
+ * page is given back to the kernel pool, under its lock and with interrupts
+ * enabled again.
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *obj) {
+  ASSERT(obj != NULL);
+  enum intr_status old_status = intr_disable();
+  struct slab *slab = (struct slab *)((uint32_t)obj & 0xfffff000);
+  ASSERT(slab->cache == cache && slab->inuse > 0);
+  uint32_t obj_idx = ((uint8_t *)obj - slab->objs) / cache->obj_size;
+  ASSERT(obj_idx < cache->obj_per_slab);
+
+  list_remove(&slab->slab_tag);
+  slab->free_stack[slab->free_top++] = obj_idx;
+  slab->inuse--;
+  cache->obj_inuse--;
+  cache->free_cnt++;
+
+  if (slab->inuse != 0) {
+    list_push(&cache->slabs_partial, &slab->slab_tag);
+  } else if (list_len(&cache->slabs_free) < SLAB_FREE_KEEP) {
+    list_push(&cache->slabs_free, &slab->slab_tag);
+  } else {
+    cache->slab_cnt--;
+    intr_set_status(old_status);
+    free_kernel_pages(slab, 1);
+    return;
+  }
+  intr_set_status(old_status);
+}
+
+/* initialize the list of all object caches  */
+void slab_init() { list_init(&kmem_cache_list); }
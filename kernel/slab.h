@@ -0,0 +1,58 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-20
+ */
+
+#ifndef __KERNEL_SLAB_H
+#define __KERNEL_SLAB_H
+#include "list.h"
+#include "stdint.h"
+
+#define KMEM_CACHE_NAME_LEN 16
+
+typedef void kmem_ctor(void *obj);
+
+/**
+ * struct kmem_cache - Object cache for objects of a single type.
+ * @name: Name of the cache, used when reporting statistics.
+ * @obj_size: Size of each object, rounded up to a multiple of 4 bytes.
+ * @obj_per_slab: Number of objects held by one slab (a page frame).
+ * @ctor: Constructor applied once to each object when its slab is created.
+ * @slabs_partial: Slabs with both allocated and free objects.
+ * @slabs_full: Slabs whose objects are all allocated.
+ * @slabs_free: Slabs whose objects are all free, kept for reuse.
+ * @cache_tag: Element in the global list of caches.
+ * @slab_cnt: Number of slabs currently owned by the cache.
+ * @obj_inuse: Number of objects currently allocated.
+ * @alloc_cnt: Total number of allocations served.
+ * @free_cnt: Total number of objects given back.
+ * @grow_cnt: Total number of slabs created.
+ *
+ * Objects are handed out already constructed, and must be given back in their
+ * constructed state, so that neither allocation nor free needs to clear the
+ * whole object.
+ */
+struct kmem_cache {
+  char name[KMEM_CACHE_NAME_LEN];
+  uint32_t obj_size;
+  uint32_t obj_per_slab;
+  kmem_ctor *ctor;
+  struct list slabs_partial;
+  struct list slabs_full;
+  struct list slabs_free;
+  struct list_elem cache_tag;
+
+  uint32_t slab_cnt;
+  uint32_t obj_inuse;
+  uint32_t alloc_cnt;
+  uint32_t free_cnt;
+  uint32_t grow_cnt;
+};
+
+extern struct list kmem_cache_list;
+void slab_init();
+void kmem_cache_init(struct kmem_cache *cache, char *name, uint32_t obj_size,
+                     kmem_ctor *ctor);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+#endif
@@ -0,0 +1,175 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-29
+ */
+#include "swap.h"
+#include "debug.h"
+#include "fs.h"
+#include "global.h"
+#include "ide.h"
+#include "interrupt.h"
+#include "list.h"
+#include "memory.h"
+#include "stdint.h"
+#include "stdio_kernel.h"
+#include "string.h"
+#include "sync.h"
+#include "thread.h"
+
+/* a slot holds one page */
+#define SECTORS_PER_SLOT (PAGE_SIZE / SECTOR_SIZE)
+/* the slot number is kept in bits 12-31 of a non-present PTE */
+#define SWAP_MAX_SLOTS (1 << 20)
+
+extern struct list partition_list;
+
+/* the swap area, NULL if SWAP_PART does not exist */
+struct partition *swap_part;
+/* number of slots in the swap area, and of slots in use */
+uint32_t swap_slot_cnt, swap_slot_used;
+/* number of PTEs referring to each slot, 0 for a free slot */
+static uint16_t *swap_map;
+/* where the search for a free slot starts */
+static uint32_t swap_hint;
+
+static struct semaphore reclaim_sema;
+/* the reclaim thread has been woken but has not finished yet */
+static bool reclaim_pending;
+
+/* find the swap partition by name, see list_traversal() */
+static bool swap_part_match(struct list_elem *pelem, int arg) {
+  struct partition *part = elem2entry(struct partition, part_tag, pelem);
+  if (strcmp(part->name, (const char *)arg) == 0) {
+    swap_part = part;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * reclaim_thread() - Keep some user frames free in the background.
+ * @arg: Unused.
+ *
+ * Sleeps until swap_wakeup() reports that the user pool runs low, then
+ * evicts pages to the swap area until SWAP_HIGH_WATERMARK frames are free,
+ * or no page can be evicted any more.
+ */
+static void reclaim_thread(void *arg UNUSED) {
+  while (1) {
+    sema_down(&reclaim_sema);
+    while (pool_free_pages(PF_USER) < SWAP_HIGH_WATERMARK &&
+           page_reclaim(SWAP_RECLAIM_BATCH) > 0) {
+    }
+    reclaim_pending = false;
+  }
+}
+
+/**
+ * swap_init() - Set up the swap area and start the reclaim thread.
+ *
+ * The swap area is the whole partition SWAP_PART, which must be found by
+ * partition_scan() before, so this runs after ide_init(). Without it, user
+ * memory is never evicted and allocations fail once the user pool is empty.
+ */
+void swap_init(void) {
+  printk("swap_init start\n");
+  list_traversal(&partition_list, swap_part_match, (int)SWAP_PART);
+  if (swap_part == NULL) {
+    printk("  no partition %s, swap disabled\n", SWAP_PART);
+    return;
+  }
+  swap_slot_cnt = swap_part->sector_cnt / SECTORS_PER_SLOT;
+  if (swap_slot_cnt > SWAP_MAX_SLOTS)
+    swap_slot_cnt = SWAP_MAX_SLOTS;
+  swap_map = sys_malloc(swap_slot_cnt * sizeof(uint16_t));
+  if (swap_map == NULL)
+    PANIC("swap_init: sys_malloc for swap_map failed");
+  memset(swap_map, 0, swap_slot_cnt * sizeof(uint16_t));
+
+  sema_init(&reclaim_sema, 0);
+  thread_start("reclaim", 16, reclaim_thread, NULL);
+  printk("  swap on %s: %d pages\n", swap_part->name, swap_slot_cnt);
+  printk("swap_init done\n");
+}
+
+/**
+ * swap_wakeup() - Wake the reclaim thread up.
+ *
+ * Called by the allocator when the user pool runs low. Waking it up again
+ * before it is done has no effect.
+ */
+void swap_wakeup(void) {
+  if (swap_part == NULL)
+    return;
+  enum intr_status old_status = intr_disable();
+  if (!reclaim_pending) {
+    reclaim_pending = true;
+    sema_up(&reclaim_sema);
+  }
+  intr_set_status(old_status);
+}
+
+/**
+ * swap_slot_alloc() - Allocate a free slot in the swap area.
+ *
+ * Return: The slot number, or -1 if the swap area is full or missing.
+ */
+int32_t swap_slot_alloc(void) {
+  enum intr_status old_status = intr_disable();
+  uint32_t cnt;
+  for (cnt = 0; cnt < swap_slot_cnt; cnt++) {
+    uint32_t slot = swap_hint;
+    if (++swap_hint == swap_slot_cnt)
+      swap_hint = 0;
+    if (swap_map[slot] == 0) {
+      swap_map[slot] = 1;
+      swap_slot_used++;
+      intr_set_status(old_status);
+      return slot;
+    }
+  }
+  intr_set_status(old_status);
+  return -1;
+}
+
+/**
+ * swap_slot_dup() - Count one more PTE referring to a slot.
+ * @slot: A slot in use.
+ *
+ * Used by fork, so that parent and child share a page that is swapped out.
+ */
+void swap_slot_dup(uint32_t slot) {
+  enum intr_status old_status = intr_disable();
+  ASSERT(slot < swap_slot_cnt && swap_map[slot] > 0 &&
+         swap_map[slot] < 0xffff);
+  swap_map[slot]++;
+  intr_set_status(old_status);
+}
+
+/**
+ * swap_slot_free() - Drop one PTE referring to a slot.
+ * @slot: A slot in use.
+ *
+ * The slot becomes free with the last one.
+ */
+void swap_slot_free(uint32_t slot) {
+  enum intr_status old_status = intr_disable();
+  ASSERT(slot < swap_slot_cnt && swap_map[slot] > 0);
+  if (--swap_map[slot] == 0)
+    swap_slot_used--;
+  intr_set_status(old_status);
+}
+
+/* read the page in 'slot' into 'buf' */
+void swap_read(uint32_t slot, void *buf) {
+  ide_read(swap_part->which_disk,
+           swap_part->start_LBA + slot * SECTORS_PER_SLOT, buf,
+           SECTORS_PER_SLOT);
+}
+
+/* write the page at 'buf' to 'slot' */
+void swap_write(uint32_t slot, void *buf) {
+  ide_write(swap_part->which_disk,
+            swap_part->start_LBA + slot * SECTORS_PER_SLOT, buf,
+            SECTORS_PER_SLOT);
+}
@@ -0,0 +1,31 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-29
+ */
+#ifndef __KERNEL_SWAP_H
+#define __KERNEL_SWAP_H
+#include "global.h"
+#include "ide.h"
+#include "stdint.h"
+
+/* the partition used as swap area, never formatted by filesys_init() */
+#ifndef SWAP_PART
+#define SWAP_PART "sdb5"
+#endif
+/* the reclaim thread is woken when fewer user frames than this are free */
+#define SWAP_LOW_WATERMARK 64
+/* and evicts pages until this many are free */
+#define SWAP_HIGH_WATERMARK 128
+/* number of pages the reclaim thread evicts per call of page_reclaim() */
+#define SWAP_RECLAIM_BATCH 16
+
+extern struct partition *swap_part;
+extern uint32_t swap_slot_cnt, swap_slot_used;
+void swap_init(void);
+void swap_wakeup(void);
+int32_t swap_slot_alloc(void);
+void swap_slot_dup(uint32_t slot);
+void swap_slot_free(uint32_t slot);
+void swap_read(uint32_t slot, void *buf);
+void swap_write(uint32_t slot, void *buf);
+#endif
@@ -0,0 +1,399 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-26
+ */
+#include "vma.h"
+#include "debug.h"
+#include "global.h"
+#include "process.h"
+#include "slab.h"
+#include "stdint.h"
+#include "thread.h"
+#include "userprog.h"
+
+static struct kmem_cache vma_cache;
+
+static int32_t vma_height(struct vm_area *node) {
+  return node == NULL ? 0 : node->height;
+}
+
+static uint32_t vma_max_gap(struct vm_area *node) {
+  return node == NULL ? 0 : node->max_gap;
+}
+
+/**
+ * vma_update() - Recompute the height and the largest gap of a subtree from
+ * its children.
+ * @node: The root of the subtree.
+ */
+static void vma_update(struct vm_area *node) {
+  int32_t height_left = vma_height(node->left);
+  int32_t height_right = vma_height(node->right);
+  node->height = (height_left > height_right ? height_left : height_right) + 1;
+
+  uint32_t max_gap = node->gap;
+  if (vma_max_gap(node->left) > max_gap)
+    max_gap = vma_max_gap(node->left);
+  if (vma_max_gap(node->right) > max_gap)
+    max_gap = vma_max_gap(node->right);
+  node->max_gap = max_gap;
+}
+
+static struct vm_area *vma_rotate_right(struct vm_area *node) {
+  struct vm_area *pivot = node->left;
+  node->left = pivot->right;
+  pivot->right = node;
+  vma_update(node);
+  vma_update(pivot);
+  return pivot;
+}
+
+static struct vm_area *vma_rotate_left(struct vm_area *node) {
+  struct vm_area *pivot = node->right;
+  node->right = pivot->left;
+  pivot->left = node;
+  vma_update(node);
+  vma_update(pivot);
+  return pivot;
+}
+
+/**
+ * vma_balance() - Restore the AVL property of a subtree whose children differ
+ * in height by at most two.
+ * @node: The root of the subtree.
+ *
+ * Return: The new root of the subtree.
+ */
+static struct vm_area *vma_balance(struct vm_area *node) {
+  vma_update(node);
+  int32_t factor = vma_height(node->left) - vma_height(node->right);
+  if (factor > 1) {
+    if (vma_height(node->left->left) < vma_height(node->left->right))
+      node->left = vma_rotate_left(node->left);
+    return vma_rotate_right(node);
+  }
+  if (factor < -1) {
+    if (vma_height(node->right->right) < vma_height(node->right->left))
+      node->right = vma_rotate_right(node->right);
+    return vma_rotate_left(node);
+  }
+  return node;
+}
+
+static struct vm_area *tree_insert(struct vm_area *node, struct vm_area *vma) {
+  if (node == NULL)
+    return vma;
+  if (vma->start < node->start)
+    node->left = tree_insert(node->left, vma);
+  else
+    node->right = tree_insert(node->right, vma);
+  return vma_balance(node);
+}
+
+static struct vm_area *tree_remove_min(struct vm_area *node,
+                                       struct vm_area **min) {
+  if (node->left == NULL) {
+    *min = node;
+    return node->right;
+  }
+  node->left = tree_remove_min(node->left, min);
+  return vma_balance(node);
+}
+
+/**
+ * tree_erase() - Unlink the region starting at 'start' from a subtree.
+ * @node: The root of the subtree.
+ * @start: The start of the region, which must be in the subtree.
+ *
+ * The node is unlinked rather than overwritten by its successor, so pointers
+ * to the other regions stay valid.
+ *
+ * Return: The new root of the subtree.
+ */
+static struct vm_area *tree_erase(struct vm_area *node, uint32_t start) {
+  ASSERT(node != NULL);
+  if (start < node->start) {
+    node->left = tree_erase(node->left, start);
+  } else if (start > node->start) {
+    node->right = tree_erase(node->right, start);
+  } else {
+    if (node->right == NULL)
+      return node->left;
+    struct vm_area *min;
+    struct vm_area *right = tree_remove_min(node->right, &min);
+    min->left = node->left;
+    min->right = right;
+    return vma_balance(min);
+  }
+  return vma_balance(node);
+}
+
+/* recompute the largest gaps on the path down to the region at 'start' */
+static void tree_refresh(struct vm_area *node, uint32_t start) {
+  if (node == NULL)
+    return;
+  if (start < node->start)
+    tree_refresh(node->left, start);
+  else if (start > node->start)
+    tree_refresh(node->right, start);
+  vma_update(node);
+}
+
+static void tree_free(struct vm_area *node) {
+  if (node == NULL)
+    return;
+  tree_free(node->left);
+  tree_free(node->right);
+  kmem_cache_free(&vma_cache, node);
+}
+
+static struct vm_area *tree_copy(struct vm_area *node) {
+  struct vm_area *copy = kmem_cache_alloc(&vma_cache);
+  if (copy == NULL)
+    return NULL;
+  *copy = *node;
+  copy->left = copy->right = NULL;
+  if ((node->left != NULL && (copy->left = tree_copy(node->left)) == NULL) ||
+      (node->right != NULL && (copy->right = tree_copy(node->right)) == NULL)) {
+    tree_free(copy);
+    return NULL;
+  }
+  return copy;
+}
+
+/* the last region starting below vaddr */
+static struct vm_area *vma_prev(struct task_struct *pthread, uint32_t vaddr) {
+  struct vm_area *node = pthread->vma_root;
+  struct vm_area *prev = NULL;
+  while (node != NULL) {
+    if (node->start < vaddr) {
+      prev = node;
+      node = node->right;
+    } else {
+      node = node->left;
+    }
+  }
+  return prev;
+}
+
+/* set the gap in front of 'vma' from its predecessor, and refresh the tree */
+static void vma_set_gap(struct task_struct *pthread, struct vm_area *vma) {
+  struct vm_area *prev = vma_prev(pthread, vma->start);
+  vma->gap = vma->start - (prev == NULL ? USER_VADDR_START : prev->end);
+  tree_refresh(pthread->vma_root, vma->start);
+}
+
+/**
+ * vma_init() - Create the cache the regions are allocated from.
+ */
+void vma_init(void) {
+  kmem_cache_init(&vma_cache, "vm_area", sizeof(struct vm_area), NULL);
+}
+
+/**
+ * vma_create() - Set up the address space of a new user process.
+ * @pthread: The PCB of the process.
+ *
+ * The address space starts with the stack region alone. It also bounds the
+ * free space searched by vma_alloc() from above.
+ *
+ * Return: True on success, false if no region could be allocated.
+ */
+bool vma_create(struct task_struct *pthread) {
+  pthread->vma_root = NULL;
+  return vma_insert(pthread, 0xc0000000 - USER_STACK_LIMIT, USER_STACK_LIMIT,
+                    VM_READ | VM_WRITE | VM_STACK) != NULL;
+}
+
+/**
+ * vma_find() - Look up the region containing an address.
+ * @pthread: The PCB of the process.
+ * @vaddr: The user virtual address.
+ *
+ * Return: The region, or NULL if vaddr is not in any region.
+ */
+struct vm_area *vma_find(struct task_struct *pthread, uint32_t vaddr) {
+  struct vm_area *node = pthread->vma_root;
+  while (node != NULL) {
+    if (vaddr < node->start)
+      node = node->left;
+    else if (vaddr >= node->end)
+      node = node->right;
+    else
+      return node;
+  }
+  return NULL;
+}
+
+/**
+ * vma_next() - Look up the first region starting at or above an address.
+ * @pthread: The PCB of the process.
+ * @vaddr: The user virtual address.
+ *
+ * Walking all regions in address order is done by starting from
+ * USER_VADDR_START and passing the end of the previous region.
+ *
+ * Return: The region, or NULL if there is none.
+ */
+struct vm_area *vma_next(struct task_struct *pthread, uint32_t vaddr) {
+  struct vm_area *node = pthread->vma_root;
+  struct vm_area *next = NULL;
+  while (node != NULL) {
+    if (node->start >= vaddr) {
+      next = node;
+      node = node->left;
+    } else {
+      node = node->right;
+    }
+  }
+  return next;
+}
+
+/**
+ * vma_insert() - Add a region at a fixed address.
+ * @pthread: The PCB of the process.
+ * @start: The start of the region, page aligned.
+ * @len: The length of the region in bytes, a multiple of PAGE_SIZE.
+ * @flags: Permissions and kind of the region (VM_*).
+ *
+ * The region is merged with its neighbours when they touch it and have the
+ * same flags, so a heap grown page by page stays a single region.
+ *
+ * Return: The region covering the range, or NULL if the range overlaps a
+ * region, is outside the user address space or no region could be allocated.
+ */
+struct vm_area *vma_insert(struct task_struct *pthread, uint32_t start,
+                           uint32_t len, uint32_t flags) {
+  ASSERT(start % PAGE_SIZE == 0 && len % PAGE_SIZE == 0 && len > 0);
+  uint32_t end = start + len;
+  if (start < USER_VADDR_START || end > 0xc0000000 || end < start)
+    return NULL;
+
+  struct vm_area *prev = vma_prev(pthread, end);
+  if (prev != NULL && prev->end > start)
+    return NULL;
+  struct vm_area *next = vma_next(pthread, end);
+  bool merge = !(flags & VM_SHARED);
+  struct vm_area *vma;
+
+  if (merge && prev != NULL && prev->end == start && prev->flags == flags) {
+    prev->end = end;
+    if (next != NULL && next->start == end && next->flags == flags) {
+      /* the range fills the hole between two regions */
+      prev->end = next->end;
+      pthread->vma_root = tree_erase(pthread->vma_root, next->start);
+      kmem_cache_free(&vma_cache, next);
+      next = vma_next(pthread, prev->end);
+    }
+    vma = prev;
+  } else if (merge && next != NULL && next->start == end &&
+             next->flags == flags) {
+    /* still above 'prev', so the tree stays ordered */
+    next->start = start;
+    vma = next;
+  } else {
+    vma = kmem_cache_alloc(&vma_cache);
+    if (vma == NULL)
+      return NULL;
+    vma->start = start;
+    vma->end = end;
+    vma->flags = flags;
+    vma->gap = start - (prev == NULL ? USER_VADDR_START : prev->end);
+    vma->max_gap = vma->gap;
+    vma->height = 1;
+    vma->left = vma->right = NULL;
+    vma->file = NULL;
+    vma->pgoff = 0;
+    pthread->vma_root = tree_insert(pthread->vma_root, vma);
+  }
+  if (next != NULL)
+    vma_set_gap(pthread, next);
+  return vma;
+}
+
+/**
+ * vma_alloc() - Add a region at the lowest free range that fits.
+ * @pthread: The PCB of the process.
+ * @len: The length of the region in bytes, a multiple of PAGE_SIZE.
+ * @flags: Permissions and kind of the region (VM_*).
+ *
+ * Descends into the leftmost subtree whose largest gap is big enough, which
+ * takes O(log n) for n regions.
+ *
+ * Return: The start of the region, or 0 if there is no room.
+ */
+uint32_t vma_alloc(struct task_struct *pthread, uint32_t len, uint32_t flags) {
+  struct vm_area *node = pthread->vma_root;
+  if (node == NULL || node->max_gap < len)
+    return 0;
+  while (true) {
+    if (vma_max_gap(node->left) >= len)
+      node = node->left;
+    else if (node->gap >= len)
+      break;
+    else
+      node = node->right;
+  }
+  uint32_t start = node->start - node->gap;
+  return vma_insert(pthread, start, len, flags) ? start : 0;
+}
+
+/**
+ * vma_remove() - Remove a range from the address space.
+ * @pthread: The PCB of the process.
+ * @start: The start of the range, page aligned.
+ * @len: The length of the range in bytes, a multiple of PAGE_SIZE.
+ *
+ * Regions inside the range are dropped and regions crossing its ends are
+ * trimmed, or split if the range is in the middle of one. The pages must
+ * have been unmapped by the caller, which also takes care of the open counts
+ * of mapped files.
+ */
+void vma_remove(struct task_struct *pthread, uint32_t start, uint32_t len) {
+  uint32_t end = start + len;
+  struct vm_area *vma = vma_find(pthread, start);
+  if (vma != NULL && vma->start < start) {
+    uint32_t vma_end = vma->end;
+    vma->end = start;
+    if (vma_end > end) {
+      struct vm_area *tail = vma_insert(pthread, end, vma_end - end, vma->flags);
+      if (tail == NULL) {
+        /* keep the range reserved if the region can not be split */
+        vma->end = vma_end;
+      } else {
+        tail->file = vma->file;
+        tail->pgoff = vma->pgoff + (end - vma->start) / PAGE_SIZE;
+      }
+      return;
+    }
+  }
+
+  while ((vma = vma_next(pthread, start)) != NULL && vma->start < end) {
+    if (vma->end > end) {
+      vma->pgoff += (end - vma->start) / PAGE_SIZE;
+      vma->start = end;
+      break;
+    }
+    pthread->vma_root = tree_erase(pthread->vma_root, vma->start);
+    kmem_cache_free(&vma_cache, vma);
+  }
+  /* only the region following the range sees its gap change */
+  vma = vma_next(pthread, end);
+  if (vma != NULL)
+    vma_set_gap(pthread, vma);
+}
+
+/**
+ * vma_copy() - Give a child process a copy of the regions of its parent.
+ * @child: The PCB of the child process.
+ * @parent: The PCB of the parent process.
+ *
+ * Return: True on success, false if the regions could not be allocated.
+ */
+bool vma_copy(struct task_struct *child, struct task_struct *parent) {
+  child->vma_root = NULL;
+  if (parent->vma_root == NULL)
+    return true;
+  child->vma_root = tree_copy(parent->vma_root);
+  return child->vma_root != NULL;
+}
@@ -0,0 +1,69 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-26
+ */
+#ifndef __KERNEL_VMA_H
+#define __KERNEL_VMA_H
+#include "global.h"
+#include "stdint.h"
+
+/* permissions of a region */
+#define VM_READ 0x1
+#define VM_WRITE 0x2
+#define VM_EXEC 0x4
+/* the region grows down on faults close to the user esp */
+#define VM_STACK 0x8
+/* the pages are shared with other processes, not copy-on-write */
+#define VM_SHARED 0x10
+/* the region maps a file through the page cache, always VM_SHARED */
+#define VM_FILE 0x20
+
+struct inode;
+struct task_struct;
+
+/**
+ * struct vm_area - A region of the user virtual address space.
+ * @start: The first address of the region, page aligned.
+ * @end: The address just past the region, page aligned.
+ * @flags: Permissions and kind of the region (VM_*).
+ * @gap: Free bytes between the previous region (or USER_VADDR_START) and
+ * 'start'.
+ * @max_gap: The largest 'gap' in the subtree rooted at this node.
+ * @height: Height of the subtree rooted at this node, a leaf is 1.
+ * @left: Subtree of the regions below this one.
+ * @right: Subtree of the regions above this one.
+ * @file: The inode mapped by a VM_FILE region, which holds one open count of
+ * it.
+ * @pgoff: The index of the page of 'file' mapped at 'start'.
+ *
+ * The regions of a process are kept in an AVL tree ordered by 'start'. They
+ * never overlap, and adjacent regions with the same flags are merged, except
+ * VM_SHARED ones, which stay one region per attached segment. All
+ * regions are backed by anonymous memory, zero-filled on the first touch,
+ * unless they were loaded by exec or map a file. Keeping the gap in front of
+ * every region, and the largest of them per subtree, lets the first free
+ * range of a given size be found in O(log n) as well.
+ */
+struct vm_area {
+  uint32_t start;
+  uint32_t end;
+  uint32_t flags;
+  uint32_t gap;
+  uint32_t max_gap;
+  int32_t height;
+  struct vm_area *left;
+  struct vm_area *right;
+  struct inode *file;
+  uint32_t pgoff;
+};
+
+void vma_init(void);
+bool vma_create(struct task_struct *pthread);
+struct vm_area *vma_find(struct task_struct *pthread, uint32_t vaddr);
+struct vm_area *vma_next(struct task_struct *pthread, uint32_t vaddr);
+struct vm_area *vma_insert(struct task_struct *pthread, uint32_t start,
+                           uint32_t len, uint32_t flags);
+uint32_t vma_alloc(struct task_struct *pthread, uint32_t len, uint32_t flags);
+void vma_remove(struct task_struct *pthread, uint32_t start, uint32_t len);
+bool vma_copy(struct task_struct *child, struct task_struct *parent);
+#endif
@@ -4,14 +4,106 @@
 #include "print.h"
 #include "string.h"
 
+/* index of the lowest set bit of a non-zero word  */
+static inline uint32_t bit_scan_forward(uint32_t word) {
+  uint32_t idx;
+  asm("bsfl %1, %0" : "=r"(idx) : "rm"(word) : "cc");
+  return idx;
+}
+
+/* number of 32-bit words covering the bitmap, the last one may be partial */
+static inline uint32_t bitmap_word_cnt(struct bitmap *btmp) {
+  return DIV_ROUND_UP(btmp->bmap_bytes_len, 4);
+}
+
+/**
+ * bitmap_word - Read the word_idx-th 32-bit word of a bitmap.
+ * @btmp: A pointer to the bitmap.
+ * @word_idx: Index of the word.
+ *
+ * The bytes of the last word which lie beyond 'bmap_bytes_len' are read as
+ * all 1, so that they are never reported as free.
+ */
+static uint32_t bitmap_word(struct bitmap *btmp, uint32_t word_idx) {
+  uint32_t byte_idx = word_idx * 4;
+  if (byte_idx + 4 <= btmp->bmap_bytes_len)
+    return ((uint32_t *)btmp->bits)[word_idx];
+
+  uint32_t word = 0xffffffff;
+  uint32_t shift = 0;
+  while (byte_idx < btmp->bmap_bytes_len) {
+    word &= ~(0xffu << shift) | ((uint32_t)btmp->bits[byte_idx] << shift);
+    byte_idx++;
+    shift += 8;
+  }
+  return word;
+}
+
+/* record in the summary whether the word_idx-th word is full */
+static void summary_update(struct bitmap *btmp, uint32_t word_idx) {
+  if (btmp->summary == NULL)
+    return;
+  uint32_t mask = BITMAP_MASK << (word_idx % 32);
+  if (bitmap_word(btmp, word_idx) == 0xffffffff) {
+    btmp->summary[word_idx / 32] |= mask;
+  } else {
+    btmp->summary[word_idx / 32] &= ~mask;
+  }
+}
+
+/**
+ * next_candidate_word - Find the first word that may have a free bit.
+ * @btmp: A pointer to the bitmap.
+ * @word_idx: Index of the word to start from.
+ *
+ * Full words are skipped 32 at a time with the help of the summary.
+ *
+ * Return: The index of the first word at or after 'word_idx' which is not
+ * known to be full, or the number of words if there is none.
+ */
+static uint32_t next_candidate_word(struct bitmap *btmp, uint32_t word_idx) {
+  uint32_t word_cnt = bitmap_word_cnt(btmp);
+  if (btmp->summary == NULL)
+    return word_idx;
+  while (word_idx < word_cnt) {
+    uint32_t not_full = ~btmp->summary[word_idx / 32] >> (word_idx % 32);
+    if (not_full != 0)
+      return word_idx + bit_scan_forward(not_full);
+    word_idx = (word_idx / 32 + 1) * 32;
+  }
+  return word_cnt;
+}
+
 /**
  * bitmap_init - Initializes a bitmap.
  * @btmp: A pointer to the bitmap to be initialized.
  *
- * Sets all bits in the provided bitmap to 0.
+ * Sets all bits in the provided bitmap to 0. The bitmap has no summary until
+ * bitmap_summary_init() is called.
  */
 void bitmap_init(struct bitmap *btmp) {
   memset(btmp->bits, 0, btmp->bmap_bytes_len);
+  btmp->summary = NULL;
+  btmp->hint = 0;
+}
+
+/**
+ * bitmap_summary_init - Attach a summary level to a bitmap.
+ * @btmp: A pointer to the bitmap, whose bits are already valid.
+ * @summary: Storage of BITMAP_SUMMARY_BYTES(btmp->bmap_bytes_len) bytes.
+ *
+ * The summary is built from the current content of the bitmap, so this is
+ * also the way to resynchronize a bitmap whose bits were loaded or copied
+ * without bitmap_set().
+ */
+void bitmap_summary_init(struct bitmap *btmp, uint32_t *summary) {
+  btmp->summary = summary;
+  btmp->hint = 0;
+  memset(summary, 0, BITMAP_SUMMARY_BYTES(btmp->bmap_bytes_len));
+  uint32_t word_idx;
+  for (word_idx = 0; word_idx < bitmap_word_cnt(btmp); word_idx++) {
+    summary_update(btmp, word_idx);
+  }
 }
 
 /**
@@ -33,51 +125,62 @@ bool bitmap_bit_test(struct bitmap *btmp, uint32_t bit_idx) {
  * @btmp: A pointer to the bitmap.
  * @cnt: The number of consecutive unset (0) bits to find.
  *
- * Scans for a sequence of unset bits that are at least 'cnt' bits long.
+ * Scans for the lowest sequence of unset bits that is at least 'cnt' bits
+ * long. The bitmap is examined 32 bits at a time: the scan starts from the
+ * 'hint' word, skips full words through the summary, and measures runs of
+ * free bits inside a word with bsf instead of testing bit by bit.
  *
  * Return: The starting index of the sequence if found, -1 otherwise.
  */
 int bitmap_scan(struct bitmap *btmp, uint32_t cnt) {
-  uint32_t byte_idx = 0;
-  /* testing by bytes to exclude bytes that are all 1  */
-  while ((0xff == btmp->bits[byte_idx]) && (byte_idx < btmp->bmap_bytes_len))
-    ++byte_idx;
-
-  ASSERT(byte_idx < btmp->bmap_bytes_len);
-  /* all bytes are 1 so that there is no bit that is 0, return -1  */
-  if (byte_idx == btmp->bmap_bytes_len)
-    return -1;
+  ASSERT(cnt > 0);
+  uint32_t word_cnt = bitmap_word_cnt(btmp);
+  uint32_t word_idx = btmp->hint;
+  uint32_t run_start = 0, run_len = 0;
 
-  /* do bit by bit comparison to find bit 0 in the first byte where bit 0 is present.*/
-  int bit_idx = 0;
-  while ((uint8_t)(BITMAP_MASK << bit_idx) & btmp->bits[byte_idx])
-    ++bit_idx;
-
-  /* free_bit_idx_start is the index of the first bit 0 of the entire bitmap */
-  int free_bit_idx_start = byte_idx * 8 + bit_idx;
-  if (cnt == 1)
-    return free_bit_idx_start;
-
-  uint32_t bit_remaining = btmp->bmap_bytes_len * 8 - free_bit_idx_start;
-  uint32_t next_bit = free_bit_idx_start + 1;
-  uint32_t count = 1;
+  while (word_idx < word_cnt) {
+    if (run_len == 0) {
+      word_idx = next_candidate_word(btmp, word_idx);
+      if (word_idx == word_cnt)
+        break;
+    }
+    /* free bits of this word are 1 in 'free' */
+    uint32_t free = ~bitmap_word(btmp, word_idx);
 
-  /* Traverse the bits in the bitmap starting from the bit after
-   * free_bit_idx_start and find the sequence  */
-  free_bit_idx_start = -1;
-  while (bit_remaining-- > 0) {
-    if (!bitmap_bit_test(btmp, next_bit)) {
-      ++count;
+    if (free == 0) {
+      /* a full word breaks the run  */
+      run_len = 0;
+    } else if (free == 0xffffffff) {
+      if (run_len == 0)
+        run_start = word_idx * 32;
+      run_len += 32;
+      if (run_len >= cnt)
+        return run_start;
     } else {
-      count = 0;
-    }
-    if (count == cnt) {
-      free_bit_idx_start = next_bit - cnt + 1;
-      break;
+      uint32_t pos = 0;
+      while (pos < 32) {
+        uint32_t remain = free >> pos;
+        if (run_len == 0) {
+          /* no run in progress, jump to the next free bit  */
+          if (remain == 0)
+            break;
+          pos += bit_scan_forward(remain);
+          run_start = word_idx * 32 + pos;
+          remain = free >> pos;
+        }
+        /* length of the free bits starting from pos  */
+        uint32_t free_len = bit_scan_forward(~remain);
+        run_len += free_len;
+        if (run_len >= cnt)
+          return run_start;
+        pos += free_len;
+        if (pos < 32)
+          run_len = 0;
+      }
     }
-    ++next_bit;
+    word_idx++;
   }
-  return free_bit_idx_start;
+  return -1;
 }
 
 /**
@@ -86,16 +189,23 @@ int bitmap_scan(struct bitmap *btmp, uint32_t cnt) {
  * @bit_idx: The index of the bit to set or clear.
  * @value: The value to set the bit to (0 or 1).
  *
- * Sets the bit at index 'bit_idx' in the bitmap to 'value'.
+ * Sets the bit at index 'bit_idx' in the bitmap to 'value', and keeps the
+ * summary and the hint of the bitmap up to date.
  */
 void bitmap_set(struct bitmap *btmp, uint32_t bit_idx, int8_t value) {
   ASSERT((value == 0) || (value == 1));
   uint32_t byte_idx = bit_idx / 8;
   uint32_t bit_idx_in_byte = bit_idx % 8;
+  uint32_t word_idx = bit_idx / 32;
 
   if (value) {
     btmp->bits[byte_idx] |= BITMAP_MASK << bit_idx_in_byte;
+    if (word_idx == btmp->hint && bitmap_word(btmp, word_idx) == 0xffffffff)
+      btmp->hint++;
   } else {
     btmp->bits[byte_idx] &= ~(BITMAP_MASK << bit_idx_in_byte);
+    if (word_idx < btmp->hint)
+      btmp->hint = word_idx;
   }
+  summary_update(btmp, word_idx);
 }
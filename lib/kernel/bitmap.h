@@ -6,20 +6,31 @@
 
 #define BITMAP_MASK 1
 
+/* bytes of the summary level of a bitmap which is 'bytes_len' bytes long */
+#define BITMAP_SUMMARY_BYTES(bytes_len) (DIV_ROUND_UP(bytes_len, 128) * 4)
+
 /**
  * struct bitmap - Represents a bitmap data structure.
  * @bmap_bytes_len: Length of the bitmap in bytes.
  * @bits: Pointer to the array of bytes representing the bitmap.
+ * @summary: Optional second level, bit i is set when the i-th 32-bit word of
+ * 'bits' is full. NULL if the bitmap has no summary.
+ * @hint: Index of a 32-bit word of 'bits' below which there is no free bit.
  *
  * This structure is used to manage a bitmap, a collection of bits that
- * represents binary data efficiently.
+ * represents binary data efficiently. Bits must be changed through
+ * bitmap_set() so that 'summary' and 'hint' stay valid, unless the bitmap is
+ * re-initialized by bitmap_init() or bitmap_summary_init() afterwards.
  */
 struct bitmap {
   uint32_t bmap_bytes_len;
   uint8_t *bits;
+  uint32_t *summary;
+  uint32_t hint;
 };
 
 void bitmap_init(struct bitmap *btmp);
+void bitmap_summary_init(struct bitmap *btmp, uint32_t *summary);
 bool bitmap_bit_test(struct bitmap *btmp, uint32_t bit_idx);
 int bitmap_scan(struct bitmap *btmp, uint32_t cnt);
 void bitmap_set(struct bitmap *btmp, uint32_t bit_idx, int8_t value);
@@ -0,0 +1,312 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-31
+ */
+#include "malloc.h"
+#include "global.h"
+#include "stdint.h"
+#include "string.h"
+#include "syscall.h"
+
+/* the low bits of a chunk size are flags, sizes are multiples of 8 */
+#define CHUNK_INUSE 0x1
+#define CHUNK_MMAPPED 0x2
+#define CHUNK_FLAGS 0x7
+/* the header and the footer of a chunk */
+#define CHUNK_OVERHEAD 8
+/* a free chunk holds its header, two list pointers and its footer */
+#define CHUNK_MIN 16
+/* free lists of chunks of 16-31, 32-63, ... bytes, the last one unbounded */
+#define CLASS_CNT 13
+
+/**
+ * struct free_chunk - A free chunk of the heap.
+ * @head: The size of the chunk in bytes, or-ed with the CHUNK_* flags.
+ * @next: The next free chunk of the same size class.
+ * @prev: The previous free chunk of the same size class.
+ *
+ * Every chunk of the heap starts with 'head' and ends with a copy of it (the
+ * boundary tags), so that both neighbours of a freed chunk are found in O(1)
+ * and merged with it if they are free. The payload of a chunk in use starts
+ * right after 'head', 8-byte aligned. A free chunk is never next to another
+ * free chunk.
+ */
+struct free_chunk {
+  uint32_t head;
+  struct free_chunk *next;
+  struct free_chunk *prev;
+};
+
+static struct free_chunk *free_lists[CLASS_CNT];
+/* the address of the end mark of the heap (a header of an empty chunk in use),
+ * 0 until the first allocation */
+static uint32_t heap_end;
+
+static uint32_t chunk_size(struct free_chunk *c) {
+  return c->head & ~CHUNK_FLAGS;
+}
+
+/* write both boundary tags of chunk 'c' */
+static void chunk_set(struct free_chunk *c, uint32_t size, uint32_t flags) {
+  c->head = size | flags;
+  *(uint32_t *)((uint32_t)c + size - 4) = size | flags;
+}
+
+static uint32_t size_class(uint32_t size) {
+  uint32_t cls = 0;
+  size >>= 5;
+  while (size != 0 && cls < CLASS_CNT - 1) {
+    size >>= 1;
+    cls++;
+  }
+  return cls;
+}
+
+static void chunk_list_push(struct free_chunk *c) {
+  struct free_chunk **head = &free_lists[size_class(chunk_size(c))];
+  c->prev = NULL;
+  c->next = *head;
+  if (*head != NULL)
+    (*head)->prev = c;
+  *head = c;
+}
+
+static void chunk_list_del(struct free_chunk *c) {
+  if (c->prev != NULL)
+    c->prev->next = c->next;
+  else
+    free_lists[size_class(chunk_size(c))] = c->next;
+  if (c->next != NULL)
+    c->next->prev = c->prev;
+}
+
+/**
+ * coalesce() - Merge a free chunk with its free neighbours.
+ * @c: The chunk, marked free but not on a free list.
+ *
+ * The neighbours are taken off their free lists. The start of the heap and
+ * its end mark look like chunks in use, so the walk stops there.
+ *
+ * Return: The merged chunk, not on a free list.
+ */
+static struct free_chunk *coalesce(struct free_chunk *c) {
+  uint32_t size = chunk_size(c);
+  struct free_chunk *next = (struct free_chunk *)((uint32_t)c + size);
+  if (!(next->head & CHUNK_INUSE)) {
+    chunk_list_del(next);
+    size += chunk_size(next);
+  }
+  uint32_t prev_foot = *(uint32_t *)((uint32_t)c - 4);
+  if (!(prev_foot & CHUNK_INUSE)) {
+    c = (struct free_chunk *)((uint32_t)c - (prev_foot & ~CHUNK_FLAGS));
+    chunk_list_del(c);
+    size += chunk_size(c);
+  }
+  chunk_set(c, size, 0);
+  return c;
+}
+
+/**
+ * chunk_split() - Mark the first 'size' bytes of a chunk in use.
+ * @c: The chunk, not on a free list.
+ * @size: The size needed, no more than the size of 'c'.
+ *
+ * The rest of the chunk is freed unless it is too small to be a chunk, in
+ * which case it stays in the chunk as padding.
+ */
+static void chunk_split(struct free_chunk *c, uint32_t size) {
+  uint32_t rest = chunk_size(c) - size;
+  if (rest < CHUNK_MIN) {
+    chunk_set(c, chunk_size(c), CHUNK_INUSE);
+    return;
+  }
+  chunk_set(c, size, CHUNK_INUSE);
+  struct free_chunk *r = (struct free_chunk *)((uint32_t)c + size);
+  chunk_set(r, rest, 0);
+  chunk_list_push(coalesce(r));
+}
+
+/* the first chunk of at least 'size' bytes, searching the lists upward */
+static struct free_chunk *find_fit(uint32_t size) {
+  uint32_t cls;
+  for (cls = size_class(size); cls < CLASS_CNT; cls++) {
+    struct free_chunk *c;
+    for (c = free_lists[cls]; c != NULL; c = c->next) {
+      if (chunk_size(c) >= size) {
+        chunk_list_del(c);
+        return c;
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * heap_grow() - Extend the heap by at least 'size' bytes.
+ * @size: The size of the chunk needed.
+ *
+ * The heap grows in steps of HEAP_GROW_MIN at least, so that most allocations
+ * are served from the free lists without a system call. The new memory
+ * becomes a free chunk at the old end mark, merged with a free chunk before
+ * it. The allocator assumes it is the only one to move the break.
+ *
+ * Return: The new free chunk, not on a free list, or NULL if the kernel
+ * refused to move the break.
+ */
+static struct free_chunk *heap_grow(uint32_t size) {
+  if (heap_end == 0) {
+    /* a start mark and an end mark, the first chunk must be at 4 (mod 8) */
+    uint32_t base = (uint32_t)sbrk(0);
+    uint32_t pad = (8 - base % 8) % 8;
+    if (sbrk(pad + 8) == (void *)-1)
+      return NULL;
+    *(uint32_t *)(base + pad) = CHUNK_INUSE;
+    heap_end = base + pad + 4;
+    *(uint32_t *)heap_end = CHUNK_INUSE;
+  }
+
+  uint32_t grow = size < HEAP_GROW_MIN ? HEAP_GROW_MIN : size;
+  grow = DIV_ROUND_UP(grow, PAGE_SIZE) * PAGE_SIZE;
+  if (sbrk(grow) == (void *)-1)
+    return NULL;
+  struct free_chunk *c = (struct free_chunk *)heap_end;
+  chunk_set(c, grow, 0);
+  heap_end += grow;
+  *(uint32_t *)heap_end = CHUNK_INUSE;
+  return coalesce(c);
+}
+
+/**
+ * heap_trim() - Give the free chunk on top of the heap back to the kernel.
+ * @c: The free chunk ending at the end mark, not on a free list.
+ *
+ * HEAP_GROW_MIN bytes are kept, so that a program allocating and freeing
+ * the same amount in a loop does not move the break every time.
+ */
+static void heap_trim(struct free_chunk *c) {
+  uint32_t size = chunk_size(c);
+  uint32_t release = (size - HEAP_GROW_MIN) & ~(PAGE_SIZE - 1);
+  uint32_t new_brk = heap_end + 4 - release;
+  if (brk((void *)new_brk) == new_brk) {
+    size -= release;
+    chunk_set(c, size, 0);
+    heap_end -= release;
+    *(uint32_t *)heap_end = CHUNK_INUSE;
+  }
+  chunk_list_push(c);
+}
+
+/**
+ * malloc() - Allocate memory for a user program.
+ * @size: The number of bytes to allocate.
+ *
+ * Small requests are served from the segregated free lists of the heap,
+ * splitting the first chunk that fits, and only trap into the kernel when the
+ * heap has to grow. Requests of MMAP_THRESHOLD bytes or more get their own
+ * anonymous mapping, which is unmapped as a whole by free(), so that they do
+ * not pin the top of the heap.
+ *
+ * Return: The 8-byte aligned memory, or NULL if 'size' is 0 or there is no
+ * memory. It is not zeroed.
+ */
+void *malloc(uint32_t size) {
+  if (size == 0 || size > 0xc0000000)
+    return NULL;
+  if (size >= MMAP_THRESHOLD) {
+    uint32_t len = DIV_ROUND_UP(size + CHUNK_OVERHEAD, PAGE_SIZE) * PAGE_SIZE;
+    uint32_t base = (uint32_t)mmap(-1, 0, len);
+    if (base == 0)
+      return NULL;
+    ((struct free_chunk *)(base + 4))->head =
+        len | CHUNK_MMAPPED | CHUNK_INUSE;
+    return (void *)(base + CHUNK_OVERHEAD);
+  }
+
+  uint32_t csize = (size + CHUNK_OVERHEAD + 7) & ~7;
+  struct free_chunk *c = find_fit(csize);
+  if (c == NULL) {
+    c = heap_grow(csize);
+    if (c == NULL)
+      return NULL;
+  }
+  chunk_split(c, csize);
+  return (void *)((uint32_t)c + 4);
+}
+
+/**
+ * free() - Free memory allocated by malloc(), calloc() or realloc().
+ * @ptr: The memory, or NULL.
+ *
+ * The chunk is merged with its free neighbours and put on the free list of
+ * its size class. A large free chunk on top of the heap is returned to the
+ * kernel.
+ */
+void free(void *ptr) {
+  if (ptr == NULL)
+    return;
+  struct free_chunk *c = (struct free_chunk *)((uint32_t)ptr - 4);
+  if (c->head & CHUNK_MMAPPED) {
+    munmap((void *)((uint32_t)ptr - CHUNK_OVERHEAD), chunk_size(c));
+    return;
+  }
+  chunk_set(c, chunk_size(c), 0);
+  c = coalesce(c);
+  if ((uint32_t)c + chunk_size(c) == heap_end &&
+      chunk_size(c) >= HEAP_TRIM_THRESHOLD)
+    heap_trim(c);
+  else
+    chunk_list_push(c);
+}
+
+/* allocate zeroed memory for 'cnt' objects of 'size' bytes */
+void *calloc(uint32_t cnt, uint32_t size) {
+  if (size != 0 && cnt > 0xffffffff / size)
+    return NULL;
+  void *ptr = malloc(cnt * size);
+  if (ptr != NULL)
+    memset(ptr, 0, cnt * size);
+  return ptr;
+}
+
+/**
+ * realloc() - Change the size of allocated memory.
+ * @ptr: The memory, or NULL to allocate new memory.
+ * @size: The new size in bytes, 0 to free 'ptr'.
+ *
+ * A chunk of the heap is shrunk in place, or grown in place when the chunk
+ * after it is free and large enough. Otherwise the data is moved.
+ *
+ * Return: The memory, which may have moved, or NULL if there is no memory,
+ * in which case 'ptr' is left alone.
+ */
+void *realloc(void *ptr, uint32_t size) {
+  if (ptr == NULL)
+    return malloc(size);
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+  struct free_chunk *c = (struct free_chunk *)((uint32_t)ptr - 4);
+  uint32_t old_size = chunk_size(c) - CHUNK_OVERHEAD;
+  if (!(c->head & CHUNK_MMAPPED) && size < MMAP_THRESHOLD) {
+    uint32_t csize = (size + CHUNK_OVERHEAD + 7) & ~7;
+    struct free_chunk *next =
+        (struct free_chunk *)((uint32_t)c + chunk_size(c));
+    if (chunk_size(c) < csize && !(next->head & CHUNK_INUSE) &&
+        chunk_size(c) + chunk_size(next) >= csize) {
+      chunk_list_del(next);
+      chunk_set(c, chunk_size(c) + chunk_size(next), CHUNK_INUSE);
+    }
+    if (chunk_size(c) >= csize) {
+      chunk_split(c, csize);
+      return ptr;
+    }
+  }
+
+  void *new_ptr = malloc(size);
+  if (new_ptr == NULL)
+    return NULL;
+  memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+  free(ptr);
+  return new_ptr;
+}
@@ -0,0 +1,20 @@
+/*
+ * Author: Zhang Xun
+ * Time: 2023-12-31
+ */
+#ifndef __LIB_USER_MALLOC_H
+#define __LIB_USER_MALLOC_H
+#include "stdint.h"
+
+/* requests of at least this many bytes get their own anonymous mapping */
+#define MMAP_THRESHOLD 0x20000
+/* the heap grows by at least this many bytes at a time */
+#define HEAP_GROW_MIN 0x10000
+/* free memory on top of the heap beyond this is given back to the kernel */
+#define HEAP_TRIM_THRESHOLD 0x20000
+
+void *malloc(uint32_t size);
+void free(void *ptr);
+void *calloc(uint32_t cnt, uint32_t size);
+void *realloc(void *ptr, uint32_t size);
+#endif
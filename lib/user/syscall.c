@@ -127,3 +127,67 @@ void ps(void) { _syscall0(SYS_PS); }
 int32_t execv(const char *path, char *const argv[]) {
   return _syscall2(SYS_EXECV, path, argv);
 }
+
+/* get the shared memory segment of 'key', creating it with 'size' bytes  */
+int32_t shmget(int32_t key, uint32_t size) {
+  return _syscall2(SYS_SHMGET, key, size);
+}
+
+/* attach shared memory segment 'shm_id' at 'addr' (NULL: kernel chooses) */
+void *shmat(int32_t shm_id, void *addr) {
+  return (void *)_syscall2(SYS_SHMAT, shm_id, addr);
+}
+
+/* detach the shared memory segment attached at 'addr'  */
+int32_t shmdt(void *addr) { return _syscall1(SYS_SHMDT, addr); }
+
+/* remove shared memory segment 'shm_id'  */
+int32_t shmrm(int32_t shm_id) { return _syscall1(SYS_SHMRM, shm_id); }
+
+/* map 'length' bytes of file 'fd' from 'offset' (page aligned), shared, or
+ * anonymous memory if 'fd' is -1 */
+void *mmap(int32_t fd, uint32_t offset, uint32_t length) {
+  return (void *)_syscall3(SYS_MMAP, fd, offset, length);
+}
+
+/* remove the mapping at 'addr', writing the dirty pages of a file back */
+int32_t munmap(void *addr, uint32_t length) {
+  return _syscall2(SYS_MUNMAP, addr, length);
+}
+
+/* print the outstanding kernel allocations by call site */
+void alloc_dump(void) { _syscall0(SYS_ALLOC_DUMP); }
+
+/* set the end of the heap to 'addr', return the new end (the old on failure) */
+uint32_t brk(void *addr) { return _syscall1(SYS_BRK, addr); }
+
+/* move the end of the heap by 'increment', return the old end or (void*)-1 */
+void *sbrk(int32_t increment) {
+  uint32_t old_brk = brk(NULL);
+  uint32_t new_brk = old_brk + increment;
+  if (increment != 0 && brk((void *)new_brk) != new_brk)
+    return (void *)-1;
+  return (void *)old_brk;
+}
+
+/* print the usage of the memory pools, size classes and processes */
+void meminfo(void) { _syscall0(SYS_MEMINFO); }
+
+/* set the base scheduling level of task 'pid' (0: self), 0 is the highest */
+int32_t setpriority(pid_t pid, uint32_t level) {
+  return _syscall2(SYS_SETPRIORITY, pid, level);
+}
+
+/* sleep for 'm_seconds' milliseconds, rounded up to timer ticks */
+void msleep(uint32_t m_seconds) { _syscall1(SYS_SLEEP, m_seconds); }
+
+/* sleep for 'seconds' seconds, always returns 0 (nothing interrupts it) */
+uint32_t sleep(uint32_t seconds) {
+  msleep(seconds * 1000);
+  return 0;
+}
+
+/* read clock 'clock_id' (CLOCK_*) into 'tp', return 0 or -1 if it is unknown */
+int32_t clock_gettime(uint32_t clock_id, struct timespec *tp) {
+  return _syscall2(SYS_CLOCK_GETTIME, clock_id, tp);
+}
@@ -7,6 +7,7 @@
 #include "fs.h"
 #include "stdint.h"
 #include "thread.h"
+#include "timer.h"
 enum SYSCALL_NR {
   SYS_GETPID,
   SYS_WRITE,
@@ -28,7 +29,19 @@ enum SYSCALL_NR {
   SYS_REWINDDIR,
   SYS_STAT,
   SYS_PS,
-  SYS_EXECV
+  SYS_EXECV,
+  SYS_SHMGET,
+  SYS_SHMAT,
+  SYS_SHMDT,
+  SYS_SHMRM,
+  SYS_MMAP,
+  SYS_MUNMAP,
+  SYS_ALLOC_DUMP,
+  SYS_BRK,
+  SYS_MEMINFO,
+  SYS_SETPRIORITY,
+  SYS_SLEEP,
+  SYS_CLOCK_GETTIME
 };
 uint32_t getpid();
 uint32_t write(int32_t fd, const void *buf, uint32_t count);
@@ -51,5 +64,19 @@ int32_t stat(const char *path, struct stat *buf);
 int32_t chdir(const char *path);
 void ps(void);
 int32_t execv(const char *path, char *const argv[]);
+int32_t shmget(int32_t key, uint32_t size);
+void *shmat(int32_t shm_id, void *addr);
+int32_t shmdt(void *addr);
+int32_t shmrm(int32_t shm_id);
+void *mmap(int32_t fd, uint32_t offset, uint32_t length);
+int32_t munmap(void *addr, uint32_t length);
+void alloc_dump(void);
+uint32_t brk(void *addr);
+void *sbrk(int32_t increment);
+void meminfo(void);
+int32_t setpriority(pid_t pid, uint32_t level);
+void msleep(uint32_t m_seconds);
+uint32_t sleep(uint32_t seconds);
+int32_t clock_gettime(uint32_t clock_id, struct timespec *tp);
 
 #endif
@@ -301,6 +301,20 @@ void buildin_ps(uint32_t argc, char **argv UNUSED) {
   }
   ps();
 }
+void buildin_allocs(uint32_t argc, char **argv UNUSED) {
+  if (argc != 1) {
+    printf("allocs: too many arguments\n");
+    return;
+  }
+  alloc_dump();
+}
+void buildin_meminfo(uint32_t argc, char **argv) {
+  if (argc != 1) {
+    printf("%s: too many arguments\n", argv[0]);
+    return;
+  }
+  meminfo();
+}
 void buildin_clear(uint32_t argc, char **argv UNUSED) {
   if (argc != 1) {
     printf("clear: too many arguments\n");
@@ -8,6 +8,8 @@ char *buildin_cd(uint32_t argc, char **argv);
 void buildin_ls(uint32_t argc, char **argv);
 void buildin_pwd(uint32_t argc, char **argv UNUSED);
 void buildin_ps(uint32_t argc, char **argv UNUSED);
+void buildin_allocs(uint32_t argc, char **argv UNUSED);
+void buildin_meminfo(uint32_t argc, char **argv);
 void buildin_clear(uint32_t argc, char **argv UNUSED);
 int32_t buildin_mkdir(uint32_t argc, char **argv);
 int32_t buildin_rmdir(uint32_t argc, char **argv);
@@ -142,6 +142,10 @@ void zx_shell() {
       buildin_pwd(argc, argv);
     } else if (!strcmp("ps", argv[0])) {
       buildin_ps(argc, argv);
+    } else if (!strcmp("allocs", argv[0])) {
+      buildin_allocs(argc, argv);
+    } else if (!strcmp("free", argv[0]) || !strcmp("meminfo", argv[0])) {
+      buildin_meminfo(argc, argv);
     } else if (!strcmp("clear", argv[0])) {
       buildin_clear(argc, argv);
     } else if (!strcmp("mkdir", argv[0])) {
@@ -19,10 +19,16 @@
 #include "string.h"
 #include "switch.h"
 #include "sync.h"
+#include "timer.h"
 
 struct task_struct *main_thread;
 struct task_struct *idle_thread;
-struct list thread_ready_list;
+/* the ready tasks of each MLFQ level, bit i of ready_bitmap is set when
+ * level i is not empty */
+static struct list thread_ready_lists[MLFQ_LEVELS];
+static uint32_t ready_bitmap;
+/* the TSC at the last context switch, 0 without a TSC */
+static uint64_t switch_tsc;
 struct list thread_all_list;
 struct lock pid_lock;
 
@@ -93,9 +99,11 @@ void init_thread(struct task_struct *thread, char *name, int _priority) {
 
   thread->self_kstack = (uint32_t *)((uint32_t)thread + PAGE_SIZE);
   thread->priority = _priority;
+  thread->level = thread->base_level = 0;
   /* the larger priority is, the longer time slice is */
-  thread->ticks = _priority;
+  thread->ticks = thread_time_slice(thread);
   thread->elapsed_ticks = 0;
+  thread->cpu_cycles = 0;
   thread->pg_dir = NULL;
 
   thread->fd_table[0] = 0;
@@ -112,6 +120,108 @@ void init_thread(struct task_struct *thread, char *name, int _priority) {
   thread->stack_magic = 0x20011124;
 }
 
+/**
+ * thread_time_slice() - The time slice of a task at its current level.
+ * @pthread: The task.
+ *
+ * The lower the level, the longer the slice, so that CPU-bound tasks, which
+ * sink to the low levels, are switched less often, while the tasks at the
+ * high levels, which run often, get short slices. 'priority' scales it.
+ *
+ * Return: The slice in ticks, at least 1.
+ */
+uint8_t thread_time_slice(struct task_struct *pthread) {
+  uint32_t slice = pthread->priority * (pthread->level + 2) / 4;
+  if (slice == 0)
+    return 1;
+  return slice > 255 ? 255 : slice;
+}
+
+/* queue a ready task at its level, at the front if 'front' */
+static void ready_enqueue(struct task_struct *pthread, bool front) {
+  struct list *ready_list = &thread_ready_lists[pthread->level];
+  ASSERT(!list_elem_find(ready_list, &pthread->general_tag));
+  if (front)
+    list_push(ready_list, &pthread->general_tag);
+  else
+    list_append(ready_list, &pthread->general_tag);
+  ready_bitmap |= 1 << pthread->level;
+}
+
+/* take a ready task off its level */
+static void ready_dequeue(struct task_struct *pthread) {
+  list_remove(&pthread->general_tag);
+  if (list_empty(&thread_ready_lists[pthread->level]))
+    ready_bitmap &= ~(1 << pthread->level);
+}
+
+/* pop the first task of the highest non-empty level, there must be one */
+static struct task_struct *ready_pick(void) {
+  uint32_t level;
+  ASSERT(ready_bitmap != 0);
+  asm("bsf %1, %0" : "=r"(level) : "rm"(ready_bitmap));
+  struct task_struct *next = elem2entry(struct task_struct, general_tag,
+                                        list_pop(&thread_ready_lists[level]));
+  if (list_empty(&thread_ready_lists[level]))
+    ready_bitmap &= ~(1 << level);
+  return next;
+}
+
+/**
+ * thread_ready() - Make a new task, which is in no list yet, runnable.
+ * @pthread: The task, with status TASK_READY.
+ */
+void thread_ready(struct task_struct *pthread) {
+  enum intr_status old_status = intr_disable();
+  ASSERT(pthread->status == TASK_READY);
+  ready_enqueue(pthread, false);
+  intr_set_status(old_status);
+}
+
+/**
+ * thread_preempt_pending() - Check whether a task of a higher level than the
+ * running one is ready.
+ *
+ * Called on every tick, so that a task woken up at a high level, like the
+ * shell after a key press, waits one tick at most for a CPU-bound task.
+ */
+bool thread_preempt_pending(void) {
+  return (ready_bitmap & ((1 << running_thread()->level) - 1)) != 0;
+}
+
+static bool boost_task(struct list_elem *pelem, int arg UNUSED) {
+  struct task_struct *pthread =
+      elem2entry(struct task_struct, all_list_tag, pelem);
+  if (pthread->level == pthread->base_level)
+    return false;
+  if (pthread->status == TASK_READY) {
+    ready_dequeue(pthread);
+    pthread->level = pthread->base_level;
+    ready_enqueue(pthread, false);
+  } else {
+    pthread->level = pthread->base_level;
+  }
+  return false;
+}
+
+/**
+ * thread_boost_all() - Put every task back to its base level.
+ *
+ * Context: Called by the timer every MLFQ_BOOST_MS, interrupts disabled.
+ */
+void thread_boost_all(void) {
+  ASSERT(intr_get_status() == INTR_OFF);
+  list_traversal(&thread_all_list, boost_task, 0);
+}
+
+/* the TSC cycles the running task has run for, its current run included */
+uint64_t thread_cpu_cycles(void) {
+  enum intr_status old_status = intr_disable();
+  uint64_t cycles = running_thread()->cpu_cycles + (tsc_read() - switch_tsc);
+  intr_set_status(old_status);
+  return cycles;
+}
+
 /**
  * thread_start - create a new thread
  */
@@ -121,8 +231,7 @@ struct task_struct *thread_start(char *name, int _priority,
   init_thread(thread, name, _priority);
   thread_create(thread, function, func_arg);
 
-  ASSERT(!list_elem_find(&thread_ready_list, &thread->general_tag));
-  list_append(&thread_ready_list, &thread->general_tag);
+  thread_ready(thread);
   ASSERT(!list_elem_find(&thread_all_list, &thread->all_list_tag));
   list_append(&thread_all_list, &thread->all_list_tag);
 
@@ -141,45 +250,52 @@ static void make_main_thread() {
 }
 
 /**
- * schedule - Chooses the next thread to run using FIFO scheduling
+ * schedule - Chooses the next thread to run using a multi-level feedback queue
+ *
+ * Every level has its own ready list, and a bitmap of the non-empty levels
+ * gives the highest one with a single 'bsf', so picking the next task is
+ * O(1) however many tasks are ready. Tasks of a level run round-robin.
  *
- * Selects the next task to run from the ready list and switches context
- * to it. If the current running thread has used up its time slice or is
- * waiting, it is appended back to the ready list for later scheduling.
- * The function ensures the ready list is not empty before popping a task
- * and guarantees that the current thread is not in the ready list when
- * it is running.
+ * A running task that has used up its time slice is demoted one level and
+ * appended to its new level. One preempted by a task of a higher level
+ * keeps its level and the rest of its slice, and is queued at the front.
+ * Tasks are boosted back to their base level when woken up from a device
+ * wait (see thread_unblock()), and all of them every MLFQ_BOOST_MS.
  *
  * Context switching is performed to the next task and the status of the
- * current and next tasks are updated accordingly.
+ * current and next tasks are updated accordingly. The TSC cycles since the
+ * previous switch are charged to the current task right before, so the CPU
+ * time of every task, the idle one included, is exact to the cycle.
  */
 void schedule() {
   ASSERT(intr_get_status() == INTR_OFF);
   struct task_struct *cur_thread = running_thread();
   if (cur_thread->status == TASK_RUNNING) {
-    /* the time slice for current thread is used up  */
-
-    /* make sure cur_thread is not in thread_ready_list  */
-    ASSERT(!list_elem_find(&thread_ready_list, &cur_thread->general_tag));
-
-    list_append(&thread_ready_list, &cur_thread->general_tag);
-    cur_thread->ticks = cur_thread->priority;
+    if (cur_thread->ticks == 0) {
+      /* the time slice for current thread is used up  */
+      if (cur_thread->level < MLFQ_LEVELS - 1)
+        cur_thread->level++;
+      cur_thread->ticks = thread_time_slice(cur_thread);
+      ready_enqueue(cur_thread, false);
+    } else {
+      /* preempted by a task of a higher level */
+      ready_enqueue(cur_thread, true);
+    }
     cur_thread->status = TASK_READY;
   } else {
     /* other events, such as thread_block, thread_yield */
   }
 
-  if (list_empty(&thread_ready_list)) {
+  if (ready_bitmap == 0) {
     thread_unblock(idle_thread);
   }
 
-  ASSERT(!list_empty(&thread_ready_list));
-  struct list_elem *thread_tag;
-  thread_tag = list_pop(&thread_ready_list);
-  /* get the starting address of pcb according to general_tag */
-  struct task_struct *next =
-      elem2entry(struct task_struct, general_tag, thread_tag);
+  struct task_struct *next = ready_pick();
   next->status = TASK_RUNNING;
+  /* charge the cycles since the last switch to the task leaving the CPU */
+  uint64_t now = tsc_read();
+  cur_thread->cpu_cycles += now - switch_tsc;
+  switch_tsc = now;
   /* update tss  */
   process_activate(next);
   switch_to(cur_thread, next);
@@ -205,16 +321,20 @@ void thread_block(enum task_status stat) {
  * @pthread: Pointer to the thread to unblock
  *
  * Moves the given thread from the blocked state to the ready state, making it
- * eligible for scheduling again.
+ * eligible for scheduling again. A thread that waited for a device goes back
+ * to its base level, so that interactive and I/O-bound tasks stay above the
+ * CPU-bound ones.
  */
 void thread_unblock(struct task_struct *pthread) {
   enum intr_status old_status = intr_disable();
   ASSERT(pthread->status == TASK_BLOCKED || pthread->status == TASK_HANGING ||
          pthread->status == TASK_WAITING);
 
-  if (list_elem_find(&thread_ready_list, &pthread->general_tag))
-    PANIC("blocked thread in ready_list\n");
-  list_push(&thread_ready_list, &pthread->general_tag);
+  if (pthread->io_wait) {
+    pthread->io_wait = false;
+    pthread->level = pthread->base_level;
+  }
+  ready_enqueue(pthread, true);
   pthread->status = TASK_READY;
   intr_set_status(old_status);
 }
@@ -224,7 +344,7 @@ void thread_unblock(struct task_struct *pthread) {
  *
  * This function allows the currently running thread to voluntarily yield the
  * CPU to other ready threads in the system. It changes the state of the
- * current thread to TASK_READY and appends it to the thread_ready_list.
+ * current thread to TASK_READY and appends it to the ready list of its level.
  * Then it calls the scheduler to select a new thread to run.
  *
  * Context: Disables interrupts to maintain atomicity and prevent race
@@ -233,8 +353,7 @@ void thread_unblock(struct task_struct *pthread) {
 void thread_yield() {
   struct task_struct *cur_thread = running_thread();
   enum intr_status old_status = intr_disable();
-  ASSERT(!list_elem_find(&thread_ready_list, &cur_thread->general_tag));
-  list_append(&thread_ready_list, &cur_thread->general_tag);
+  ready_enqueue(cur_thread, false);
   cur_thread->status = TASK_READY;
   schedule();
   intr_set_status(old_status);
@@ -246,13 +365,70 @@ static void idle(void *arg) {
     /* thread blocks itself on first run or awake from hlt instruction*/
     thread_block(TASK_BLOCKED);
 
-    /* awakened by schedule (now, thread_ready_list is empty), halt CPU  */
-    asm volatile("sti; hlt" ::: "memory");
+    /* awakened by schedule (now, no task is ready), spend the idle
+     * time zeroing page frames for the allocators in advance  */
+    while (ready_bitmap == 0 && zeroed_page_refill())
+      ;
+
+    /* halt CPU only if nothing became ready meanwhile. 'sti' takes effect
+     * after 'hlt' starts, so no wakeup is lost between the check and 'hlt' */
+    intr_disable();
+    if (ready_bitmap == 0) {
+      /* no periodic tick until the next deadline or a task becomes ready.
+       * The links of the one-shot chain and interrupts that make nothing
+       * ready only halt the CPU again */
+      timer_idle_enter();
+      do {
+        asm volatile("sti; hlt; cli" ::: "memory");
+      } while (ready_bitmap == 0 && timer_idle_pending());
+      timer_idle_exit();
+    }
+    intr_enable();
   }
 }
 
 pid_t fork_pid(void) { return allocate_pid(); }
 
+static bool pid_check(struct list_elem *pelem, int pid) {
+  struct task_struct *pthread =
+      elem2entry(struct task_struct, all_list_tag, pelem);
+  return pthread->pid == pid;
+}
+
+/**
+ * sys_setpriority() - Set the base MLFQ level of a task.
+ * @pid: The pid of the task, 0 for the running one.
+ * @level: The new base level, from 0 (highest) to MLFQ_LEVELS - 1.
+ *
+ * The task is moved to the new level at once. It is never boosted above its
+ * base level, so a larger value is a nicer task.
+ *
+ * Return: 0 on success, -1 if there is no such task or 'level' is invalid.
+ */
+int32_t sys_setpriority(pid_t pid, uint32_t level) {
+  if (level >= MLFQ_LEVELS)
+    return -1;
+  enum intr_status old_status = intr_disable();
+  struct task_struct *pthread = running_thread();
+  if (pid != 0) {
+    struct list_elem *pelem = list_traversal(&thread_all_list, pid_check, pid);
+    if (pelem == NULL) {
+      intr_set_status(old_status);
+      return -1;
+    }
+    pthread = elem2entry(struct task_struct, all_list_tag, pelem);
+  }
+  if (pthread->status == TASK_READY) {
+    ready_dequeue(pthread);
+    pthread->level = pthread->base_level = level;
+    ready_enqueue(pthread, false);
+  } else {
+    pthread->level = pthread->base_level = level;
+  }
+  intr_set_status(old_status);
+  return 0;
+}
+
 static void print_in_format(char *buf, int32_t buf_len, void *ptr,
                             char format_flag) {
   memset(buf, 0, buf_len);
@@ -327,11 +503,19 @@ void sys_ps() {
   sys_write(STDOUT_NO, ps_title, strlen(ps_title));
   /* print task info for all tasks  */
   list_traversal(&thread_all_list, print_task_info, 0);
+
+  /* user pages still backed by the shared zero page */
+  char summary[48] = {0};
+  sprintf(summary, "zero page: %d pages saved\n", zero_page_saved);
+  sys_write(STDOUT_NO, summary, strlen(summary));
 }
 
 void thread_init() {
   put_str("thread_init start\n");
-  list_init(&thread_ready_list);
+  uint32_t level;
+  for (level = 0; level < MLFQ_LEVELS; level++) {
+    list_init(&thread_ready_lists[level]);
+  }
   list_init(&thread_all_list);
   lock_init(&pid_lock);
   process_execute(init, "init");
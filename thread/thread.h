@@ -7,10 +7,17 @@
 #include "list.h"
 #include "memory.h"
 #include "stdint.h"
+#include "vma.h"
 
 #define MAX_FILES_OPEN_PER_PROC 8
 #define TASK_NAME_LEN 16
 
+/* levels of the multi-level feedback queue, 0 is the highest */
+#define MLFQ_LEVELS 8
+/* every this many milliseconds all tasks go back to their base level, so
+ * that the tasks at the lowest level are not starved */
+#define MLFQ_BOOST_MS 1000
+
 typedef void thread_func(void *);
 typedef int16_t pid_t;
 
@@ -96,10 +103,20 @@ struct task_struct {
   pid_t pid;
   enum task_status status;
   uint8_t priority;
+  /* the MLFQ level the task is queued at, and the highest one it may reach,
+   * set by sys_setpriority() */
+  uint8_t level;
+  uint8_t base_level;
+  /* the task is blocked waiting for a device, and is boosted when woken  */
+  bool io_wait;
   char name[TASK_NAME_LEN];
 
   uint8_t ticks;
   uint32_t elapsed_ticks;
+  /* TSC cycles the task ran for, up to the last time it was switched out */
+  uint64_t cpu_cycles;
+  /* the tick a sleeping task is woken up at  */
+  uint32_t wake_tick;
 
   uint32_t fd_table[MAX_FILES_OPEN_PER_PROC];
 
@@ -107,11 +124,19 @@ struct task_struct {
   struct list_elem all_list_tag;
 
   /* page table, NULL if it is TCB, */
-  uint32_t *pg_dir;
+  pte_t *pg_dir;
+#ifdef PAE
+  /* the PDPT of the four page directories of a process, loaded into CR3 */
+  pte_t pdpt[4] __attribute__((aligned(32)));
+#endif
 
-  /* virtual memory pool of user process */
-  struct virtual_addr userprog_vaddr;
+  /* regions of the user address space, NULL if it is TCB */
+  struct vm_area *vma_root;
+  /* the end of the heap, which starts at USER_BRK_START (see sys_brk()) */
+  uint32_t brk;
   struct mem_block_desc u_mb_desc_arr[MB_DESC_CNT];
+  /* per-task caches of free blocks, one for each size class  */
+  struct mem_magazine mb_mag_arr[MB_DESC_CNT];
 
   /* the inode number of current working directory   */
   uint32_t cwd_inode_NO;
@@ -132,6 +157,12 @@ void init_thread(struct task_struct *thread, char *name, int _priority);
 void thread_create(struct task_struct *thread, thread_func function,
                    void *func_arg);
 void thread_yield();
+void thread_ready(struct task_struct *pthread);
+uint8_t thread_time_slice(struct task_struct *pthread);
+bool thread_preempt_pending(void);
+void thread_boost_all(void);
+uint64_t thread_cpu_cycles(void);
+int32_t sys_setpriority(pid_t pid, uint32_t level);
 pid_t fork_pid(void);
 void sys_ps();
 #endif
@@ -6,11 +6,14 @@
 #include "global.h"
 #include "list.h"
 #include "memory.h"
+#include "page_cache.h"
+#include "shm.h"
 #include "stdint.h"
 #include "stdio.h"
 #include "stdio_kernel.h"
 #include "string.h"
 #include "thread.h"
+#include "vma.h"
 
 #define EI_NIDENT (16)
 typedef uint16_t Elf32_Half;
@@ -60,33 +63,83 @@ enum segment_type {
   PT_PHDR     /* Entry for header table itself */
 };
 
+/* segment permissions in p_flags */
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
+/**
+ * segment_range_clear() - Remove what the old image has in the pages of a
+ * segment.
+ * @start: The first page of the segment.
+ * @end: The end of the last page of the segment.
+ *
+ * The regions of the old image are kept by exec, and vma_alloc() places heap
+ * arenas and mappings first-fit from USER_VADDR_START, right where the
+ * segments of most programs go. Reusing their pages would keep their flags,
+ * their NX bit, or write into frames shared with other processes. So file
+ * mappings and shared memory segments there are removed as a whole, as by
+ * munmap and shmdt, and the private pages in the range are freed.
+ */
+static void segment_range_clear(uint32_t start, uint32_t end) {
+  struct task_struct *cur = running_thread();
+  struct vm_area *vma = vma_find(cur, start);
+  if (vma == NULL)
+    vma = vma_next(cur, start);
+  while (vma != NULL && vma->start < end) {
+    if (vma->flags & VM_FILE) {
+      sys_munmap((void *)vma->start, vma->end - vma->start);
+    } else if (vma->flags & VM_SHARED) {
+      sys_shmdt((void *)vma->start);
+    } else {
+      uint32_t from = vma->start > start ? vma->start : start;
+      uint32_t to = vma->end < end ? vma->end : end;
+      mfree_page(PF_USER, (void *)from, (to - from) / PAGE_SIZE);
+    }
+    vma = vma_next(cur, start);
+  }
+}
+
+/* the pages of a segment from the page of 'vaddr', as segment_load() maps
+ * them */
+static uint32_t segment_page_cnt(uint32_t vaddr, uint32_t file_sz) {
+  uint32_t size_in_first_page = PAGE_SIZE - (vaddr & 0x00000fff);
+  if (file_sz <= size_in_first_page)
+    return 1;
+  return DIV_ROUND_UP(file_sz - size_in_first_page, PAGE_SIZE) + 1;
+}
+
 static bool segment_load(int32_t fd, uint32_t offset, uint32_t file_sz,
-                         uint32_t vaddr) {
+                         uint32_t vaddr, uint32_t flags) {
 
   /******** caculate the number of pages required for segment ********/
   /* the first page of segment */
   uint32_t vaddr_first_page = vaddr & 0xfffff000;
-  /* the remaining size of the first page starting from the segment */
-  uint32_t size_in_first_page = PAGE_SIZE - (vaddr & 0x00000fff);
-
   /* total number of pages required for segment */
-  uint32_t segment_page_count = 0;
-
-  if (file_sz > size_in_first_page) {
-    uint32_t left_size = file_sz - size_in_first_page;
-    /* '+1' here means the first page  */
-    segment_page_count = DIV_ROUND_UP(left_size, PAGE_SIZE) + 1;
-  } else {
-    /* all segment are in the first page  */
-    segment_page_count = 1;
-  }
+  uint32_t segment_page_count = segment_page_cnt(vaddr, file_sz);
   /******** allocate memory space for segment ********/
   /* The page table used is the page table of the old process   */
   uint32_t page_idx = 0;
   uint32_t vaddr_page = vaddr_first_page;
+  struct task_struct *cur = running_thread();
   while (page_idx < segment_page_count) {
-    uint32_t *pde = pde_ptr(vaddr_page);
-    uint32_t *pte = pte_ptr(vaddr_page);
+    /* the old image is cleared by load(), so a page already in a region is
+     * shared with an earlier segment, and gets the flags of both. Its frame
+     * stays mapped while the page moves to a region with those flags */
+    struct vm_area *vma = vma_find(cur, vaddr_page);
+    uint32_t page_flags = flags;
+    bool retag = true;
+    if (vma != NULL) {
+      page_flags |= vma->flags;
+      retag = page_flags != vma->flags;
+      if (retag)
+        vma_remove(cur, vaddr_page, PAGE_SIZE);
+    }
+    if (retag && !vma_insert(cur, vaddr_page, PAGE_SIZE, page_flags)) {
+      return false;
+    }
+    pte_t *pde = pde_ptr(vaddr_page);
+    pte_t *pte = pte_ptr(vaddr_page);
 
     /* Determine whether the corresponding physical page frame exists by
      * checking whether the last bit (bit Present) is 1. if you recall the
@@ -97,6 +150,8 @@ static bool segment_load(int32_t fd, uint32_t offset, uint32_t file_sz,
       if (get_a_page(PF_USER, vaddr_page) == NULL) {
         return false;
       }
+    } else {
+      page_set_exec(vaddr_page, (page_flags & VM_EXEC) != 0);
     }
     vaddr_page += PAGE_SIZE;
     page_idx++;
@@ -138,8 +193,34 @@ static int32_t load(const char *pathname) {
   Elf32_Half prog_header_entry_size = elf_header.e_phentsize;
   Elf32_Half prog_header_entry_count = elf_header.e_phnum;
 
-  uint32_t prog_idx = 0;
+  /* the free blocks of the old heap are in pages the segments may overwrite,
+   * forget them like fork does for a child */
   struct task_struct *cur = running_thread();
+  block_desc_init(cur->u_mb_desc_arr);
+  memset(cur->mb_mag_arr, 0, sizeof(cur->mb_mag_arr));
+
+  /* clear the pages of all segments first, a page shared by two segments
+   * must keep what the first one loaded */
+  uint32_t prog_idx = 0;
+  while (prog_idx < prog_header_entry_count) {
+    sys_lseek(fd, prog_header_offset + prog_idx * prog_header_entry_size,
+              SEEK_SET);
+    if (sys_read(fd, &prog_header, prog_header_entry_size) !=
+        prog_header_entry_size) {
+      ret_val = -1;
+      goto done;
+    }
+    if (prog_header.p_type == PT_LOAD) {
+      uint32_t start = prog_header.p_vaddr & 0xfffff000;
+      segment_range_clear(
+          start, start + segment_page_cnt(prog_header.p_vaddr,
+                                          prog_header.p_filesz) *
+                             PAGE_SIZE);
+    }
+    prog_idx++;
+  }
+
+  prog_idx = 0;
   while (prog_idx < prog_header_entry_count) {
     memset(&prog_header, 0, prog_header_entry_size);
     sys_lseek(fd, prog_header_offset, SEEK_SET);
@@ -153,12 +234,14 @@ static int32_t load(const char *pathname) {
     }
 
     if (prog_header.p_type == PT_LOAD) {
+      uint32_t flags = (prog_header.p_flags & PF_R ? VM_READ : 0) |
+                       (prog_header.p_flags & PF_W ? VM_WRITE : 0) |
+                       (prog_header.p_flags & PF_X ? VM_EXEC : 0);
       if (!segment_load(fd, prog_header.p_offset, prog_header.p_filesz,
-                        prog_header.p_vaddr)) {
+                        prog_header.p_vaddr, flags)) {
         ret_val = -1;
         goto done;
       }
-      block_desc_init(cur->u_mb_desc_arr);
     }
     /* next program header entry (alse means next segment ^_^)  */
     prog_header_offset += prog_header_entry_size;
@@ -1,4 +1,3 @@
-#include "bitmap.h"
 #include "debug.h"
 #include "dir.h"
 #include "file.h"
@@ -12,124 +11,116 @@
 #include "stdint.h"
 #include "string.h"
 #include "thread.h"
+#include "vma.h"
 
 extern void intr_exit(void);
 extern struct file file_table[MAX_FILES_OPEN];
-extern struct list thread_ready_list;
 extern struct list thread_all_list;
 
 /**
- * copy_PCB_and_vaddr_bitmap() - Copy the PCB, virtual address bitmap, and
+ * copy_PCB_and_vma() - Copy the PCB, the regions of the address space, and
  * stack level 0 from the parent to the child process.
  * @child_thread: The PCB of the child process.
  * @parent_thread: The PCB of the parent process.
  *
  * This function performs the initial copy of process control block (PCB) and
- * virtual address space bitmap from the parent to the child process. It
- * includes the entire page containing the PCB and the top-level stack. After
- * copying, it modifies specific parts of the child's PCB to ensure proper
- * initialization. This includes setting the child's process ID, status,
- * priority, and initializing the memory block descriptor. The function also
- * duplicates the virtual address bitmap of the parent process for the child.
+ * the regions of the user address space from the parent to the child process.
+ * It includes the entire page containing the PCB and the top-level stack.
+ * After copying, it modifies specific parts of the child's PCB to ensure
+ * proper initialization. This includes setting the child's process ID,
+ * status, priority, and initializing the memory block descriptor. The region
+ * tree of the parent is duplicated for the child, which costs one node per
+ * region rather than a bitmap of the whole user address space.
  *
  * Return: 0 on success, -1 on failure (e.g., if memory allocation for the
- * bitmap fails).
+ * regions fails).
  */
-static int32_t copy_PCB_and_vaddr_bitmap(struct task_struct *child_thread,
-                                         struct task_struct *parent_thread) {
+static int32_t copy_PCB_and_vma(struct task_struct *child_thread,
+                                struct task_struct *parent_thread) {
   /******** build PCB for child_thread ********/
   memcpy(child_thread, parent_thread, PAGE_SIZE);
   child_thread->pid = fork_pid();
   child_thread->elapsed_ticks = 0;
+  child_thread->cpu_cycles = 0;
   child_thread->status = TASK_READY;
-  child_thread->ticks = child_thread->priority;
+  child_thread->io_wait = false;
+  child_thread->ticks = thread_time_slice(child_thread);
   child_thread->parent_pid = parent_thread->pid;
   child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
   child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
   block_desc_init(child_thread->u_mb_desc_arr);
+  memset(child_thread->mb_mag_arr, 0, sizeof(child_thread->mb_mag_arr));
 
-  /******** build vaddr bitmap for child_thread ********/
-  uint32_t bitmap_pg_cnt =
-      DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PAGE_SIZE / 8, PAGE_SIZE);
-  void *vaddr_bitmap = get_kernel_pages(bitmap_pg_cnt);
-
-  if (vaddr_bitmap == NULL)
+  /******** build regions for child_thread ********/
+  if (!vma_copy(child_thread, parent_thread))
     return -1;
-  /* copy the bitmap of virtual address pool of parent process to child process
-   */
-  memcpy(vaddr_bitmap, child_thread->userprog_vaddr.vaddr_bitmap.bits,
-         PAGE_SIZE * bitmap_pg_cnt);
-  child_thread->userprog_vaddr.vaddr_bitmap.bits = vaddr_bitmap;
   ASSERT(strlen(child_thread->name) < 11);
   strcat(child_thread->name, "_fork");
   return 0;
 }
 
 /**
- * copy_body_and_userstack() - Copy the process body (code and data) and user
- * stack from the parent to the child process.
+ * share_body_and_userstack() - Share the process body (code and data) and user
+ * stack of the parent with the child process copy-on-write.
  * @child_thread: The PCB of the child process.
  * @parent_thread: The PCB of the parent process.
- * @buf_page: Buffer used for intermediate data copying.
- *
- * This function copies the parent process's user space data (code and data
- * segments) to the child process. It iterates through the parent's virtual
- * address bitmap to find pages with data and then copies those pages. The
- * copying process involves several steps: a) Copying parent's data to a kernel
- * buffer. b) Switching page directory to the child process and allocating
- * virtual addresses. c) Copying data from the kernel buffer to the child's user
- * space. d) Restoring the parent's page directory.
  *
- * The function ensures that the child process gets an exact copy of the
- * parent's user space memory.
+ * This function walks the regions of the parent to find pages with data,
+ * skipping PT_SPAN bytes at a time where there is no page table. Instead of copying
+ * them, every such page is write-protected in the parent and mapped read-only
+ * to the same frame in the child, and the page fault handler makes a private
+ * copy for whichever process writes it first. Pages of shared memory
+ * segments stay writable and are mapped to the same frames in the child, and
+ * file mappings are left for the child to fault in from the page cache. A page
+ * that is swapped out stays in its slot, which both refer to. The PTEs of the
+ * child are written through kmap() slots, so the page directory is never
+ * switched and the TLB of the parent is kept.
  */
-static void copy_body_and_userstack(struct task_struct *child_thread,
-                                    struct task_struct *parent_thread,
-                                    void *buf_page) {
-
-  uint8_t *vaddr_bitmap = parent_thread->userprog_vaddr.vaddr_bitmap.bits;
-  uint32_t btmp_bytes_len =
-      parent_thread->userprog_vaddr.vaddr_bitmap.bmap_bytes_len;
-  uint32_t vaddr_start = parent_thread->userprog_vaddr.vaddr_start;
-  uint32_t idx_byte = 0;
-  uint32_t idx_bit = 0;
+static void share_body_and_userstack(struct task_struct *child_thread,
+                                     struct task_struct *parent_thread) {
+  struct vm_area *vma = vma_next(parent_thread, USER_VADDR_START);
   uint32_t data_page_vaddr = 0;
 
-  /******** find pages with data in parent process and copy them page by page to
-   * the child process.********/
+  /******** find pages with data in parent process and share them with the
+   * child process ********/
 
   /* heap and stack makes the data in the process discontinuous */
-  while (idx_byte < btmp_bytes_len) {
-    if (vaddr_bitmap[idx_byte] != 0) {
-      idx_bit = 0;
-      while (idx_bit < 8) {
-        /* traverse the bits within the byte  */
-        if (((BITMAP_MASK << idx_bit) & vaddr_bitmap[idx_byte]) != 0) {
-          data_page_vaddr = (idx_byte * 8 + idx_bit) * PAGE_SIZE + vaddr_start;
-
-          /******** Copy data from one process to another using the kernel
-           * buffer buf_page for transfer ********/
-
-          memcpy(buf_page, (void *)data_page_vaddr, PAGE_SIZE);
-
-          /* switch page table from parent process to child process, to make
-           * sure that the pte and pde of the page allocated to the
-           * child process are in the child process's page table  */
-          page_dir_activate(child_thread);
-
-          get_page_to_vaddr_without_bitmap(PF_USER, data_page_vaddr);
-
-          memcpy((void *)data_page_vaddr, buf_page, PAGE_SIZE);
-
-          /* restore page table, to find the next page with data  */
-          page_dir_activate(parent_thread);
-        }
-        /* next idx  */
-        idx_bit++;
+  while (vma != NULL) {
+    if (vma->flags & VM_FILE) {
+      /* the child holds its own open count of the file, and maps the pages
+       * from the page cache on its first touch */
+      enum intr_status old_status = intr_disable();
+      vma->file->i_open_cnt++;
+      intr_set_status(old_status);
+      vma = vma_next(parent_thread, vma->end);
+      continue;
+    }
+    data_page_vaddr = vma->start;
+    while (data_page_vaddr < vma->end) {
+      if (!(*pde_ptr(data_page_vaddr) & PG_P_1)) {
+        /* no page table, nothing mapped up to the next one */
+        data_page_vaddr = (data_page_vaddr & ~(PT_SPAN - 1)) + PT_SPAN;
+        continue;
+      }
+      /* pages in a region but never touched stay in the region of the child,
+       * which inherited the regions, and are backed on its first touch. The
+       * reclaim thread must not swap a page out while it is being shared */
+      enum intr_status old_status = intr_disable();
+      pte_t pte = 0;
+      if (page_mapped(data_page_vaddr)) {
+        pte = (vma->flags & VM_SHARED) ? page_share(data_page_vaddr)
+                                       : page_cow_share(data_page_vaddr);
+      } else if (page_swapped(data_page_vaddr)) {
+        pte = page_swap_share(data_page_vaddr);
       }
+      if (pte != 0) {
+        page_map_in(child_thread, data_page_vaddr, pte);
+      }
+      intr_set_status(old_status);
+      data_page_vaddr += PAGE_SIZE;
     }
-    /* next byte in parent vaddr bitmap  */
-    idx_byte++;
+    /* next region of the parent */
+    vma = vma_next(parent_thread, vma->end);
   }
 }
 
@@ -206,32 +197,26 @@ static void update_inode_open_cnt(struct task_struct *thread) {
  * @parent_thread: The task structure of the parent process.
  *
  * This function handles the duplication of the parent process's resources,
- * including the PCB, virtual address bitmap, and kernel stack, to the child
+ * including the PCB, the regions of the address space, and kernel stack, to the child
  * process. It also creates a new page directory for the child and copies the
- * parent's process body and user stack. The function updates the open file
- * descriptors count and sets up the child's thread stack. A buffer is used as
- * an intermediate space for copying data between parent and child processes.
+ * parent's process body and user stack copy-on-write. The function updates
+ * the open file descriptors count and sets up the child's thread stack.
  *
  * Return: 0 on successful copy, -1 on failure, such as if memory allocation
  * fails.
  */
 static int32_t copy_process(struct task_struct *child_thread,
                             struct task_struct *parent_thread) {
-  void *buf_page = get_kernel_pages(1);
-  if (buf_page == NULL)
-    return -1;
-
-  if (copy_PCB_and_vaddr_bitmap(child_thread, parent_thread) == -1)
+  if (copy_PCB_and_vma(child_thread, parent_thread) == -1)
     return -1;
 
-  child_thread->pg_dir = create_page_dir();
+  child_thread->pg_dir = create_page_dir(child_thread);
   if (child_thread->pg_dir == NULL)
     return -1;
 
-  copy_body_and_userstack(child_thread, parent_thread, buf_page);
+  share_body_and_userstack(child_thread, parent_thread);
   build_child_kernel_stack(child_thread);
   update_inode_open_cnt(child_thread);
-  mfree_page(PF_KERNEL, buf_page, 1);
   return 0;
 }
 
@@ -261,8 +246,7 @@ pid_t sys_fork() {
   if (copy_process(child_thread, parent_thread) == -1)
     return -1;
 
-  ASSERT(!list_elem_find(&thread_ready_list, &child_thread->general_tag));
-  list_append(&thread_ready_list, &child_thread->general_tag);
+  thread_ready(child_thread);
   ASSERT(!list_elem_find(&thread_all_list, &child_thread->all_list_tag));
   list_append(&thread_all_list, &child_thread->all_list_tag);
 
@@ -14,9 +14,9 @@
 #include "thread.h"
 #include "tss.h"
 #include "userprog.h"
+#include "vma.h"
 
 extern void intr_exit(void);
-extern struct list thread_ready_list;
 extern struct list thread_all_list;
 
 /*
@@ -68,7 +68,10 @@ void start_process(void *_filename) {
  *
  * This function loads the appropriate page directory address into CR3
  * register. If the thread is a user process, it uses its own page directory;
- * otherwise, it uses the kernel's page directory.
+ * otherwise, it uses the kernel's page directory. Kernel mappings are global
+ * pages, so only the translations of user space are flushed from TLB. With
+ * PAE, CR3 holds the PDPT, which lives in the PCB of a process and at
+ * 0x100000 for the kernel.
  */
 void page_dir_activate(struct task_struct *pthread) {
   /* kernel thread  */
@@ -76,7 +79,11 @@ void page_dir_activate(struct task_struct *pthread) {
   /* thread or process ? */
   if (pthread->pg_dir != NULL) {
     /* process, Swithc PD  */
+#ifdef PAE
+    page_dir_phy_addr = addr_v2p((uint32_t)pthread->pdpt);
+#else
     page_dir_phy_addr = addr_v2p((uint32_t)pthread->pg_dir);
+#endif
   }
   asm volatile("movl %0, %%cr3" ::"r"(page_dir_phy_addr) : "memory");
 }
@@ -98,14 +105,40 @@ void process_activate(struct task_struct *pthread) {
 
 /**
  * create_page_dir() - Create a page directory for a user process.
+ * @pthread: The PCB of the process.
  *
  * Allocates and initializes a new page directory for a user process. It copies
  * kernel entries to the new page directory and sets up a self-reference.
- * Returns a pointer (vaddr) to the newly created page directory.
+ * With PAE there are four page directories in a row, PD 3 holding the kernel
+ * entries and pointing back to all four, and the PDPT in 'pthread' is filled
+ * with them. Returns a pointer (vaddr) to the newly created page directory.
  */
-uint32_t *create_page_dir(void) {
+pte_t *create_page_dir(struct task_struct *pthread) {
+#ifdef PAE
+  pte_t *user_page_dir_vaddr = get_kernel_pages(4);
+  if (user_page_dir_vaddr == NULL) {
+    console_put_str("create_page_dir: get_kernel_pages failed!");
+    return NULL;
+  }
+
+  /* PDE 0~507 of PD 3 map the kernel (0xc0000000~0xff7fffff), copied from
+   * PD 3 of the current address space, which is seen at 0xfffff000 */
+  pte_t *kernel_pd = user_page_dir_vaddr + 3 * 512;
+  memcpy(kernel_pd, (pte_t *)0xfffff000, 508 * sizeof(pte_t));
+
+  uint32_t pd_idx;
+  for (pd_idx = 0; pd_idx < 4; pd_idx++) {
+    phys_addr_t pd_phy_addr =
+        addr_v2p((uint32_t)user_page_dir_vaddr + pd_idx * PAGE_SIZE);
+    /* PDE 508~511 of PD 3 point to the four page directories */
+    kernel_pd[508 + pd_idx] = pd_phy_addr | PG_US_U | PG_RW_W | PG_P_1;
+    /* PDPT entries only take the present bit */
+    pthread->pdpt[pd_idx] = pd_phy_addr | PG_P_1;
+  }
+  return user_page_dir_vaddr;
+#else
   /* create page directory for user process  */
-  uint32_t *user_page_dir_vaddr = get_kernel_pages(1);
+  pte_t *user_page_dir_vaddr = get_kernel_pages(1);
   if (user_page_dir_vaddr == NULL) {
     console_put_str("create_page_dir: get_kernel_pages failed!");
     return NULL;
@@ -123,26 +156,7 @@ uint32_t *create_page_dir(void) {
   user_page_dir_vaddr[1023] =
       user_page_dir_phy_addr | PG_US_U | PG_RW_W | PG_P_1;
   return user_page_dir_vaddr;
-}
-
-/**
- * create_user_vaddr_bitmap() - Create a bitmap for managing user process's
- * virtual addresses.
- * @user_prog: Pointer to the user process's task struct.
- *
- * Initializes the bitmap used for managing virtual addresses of a user
- * process, starting from a predefined user virtual address (0x8048000).
- */
-void create_user_vaddr_bitmap(struct task_struct *user_prog) {
-  user_prog->userprog_vaddr.vaddr_start = USER_VADDR_START;
-
-  /* the number of physical pages required for the user's bitmap   */
-  uint32_t bitmap_pg_cnt =
-      DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PAGE_SIZE / 8, PAGE_SIZE);
-  user_prog->userprog_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_pg_cnt);
-  user_prog->userprog_vaddr.vaddr_bitmap.bmap_bytes_len =
-      (0xc0000000 - USER_VADDR_START) / PAGE_SIZE / 8;
-  bitmap_init(&user_prog->userprog_vaddr.vaddr_bitmap);
+#endif
 }
 
 /**
@@ -152,8 +166,8 @@ void create_user_vaddr_bitmap(struct task_struct *user_prog) {
  *
  * This function creates a new user process, initializes its thread structure,
  * and adds it to the ready and all threads list. It also creates necessary
- * structures for user process like the user address space bitmap and the page
- * directory.
+ * structures for user process like the regions of the user address space and
+ * the page directory.
  */
 void process_execute(void *filename, char *name) {
   /* create PCB for user process (a thread essentially)*/
@@ -161,19 +175,20 @@ void process_execute(void *filename, char *name) {
   ASSERT(user_thread != NULL);
   /* initialize the PCB of user process*/
   init_thread(user_thread, name, default_prio);
-  /* create bitmap for virtual address space  */
-  create_user_vaddr_bitmap(user_thread);
+  /* create regions for virtual address space  */
+  if (!vma_create(user_thread))
+    PANIC("vma_create failed");
+  user_thread->brk = USER_BRK_START;
   /* initialize thread stack */
   thread_create(user_thread, start_process, filename);
   /* create user process's page directory for address mapping*/
-  user_thread->pg_dir = create_page_dir();
+  user_thread->pg_dir = create_page_dir(user_thread);
 
   block_desc_init(user_thread->u_mb_desc_arr);
 
   /* ready to run  */
   enum intr_status old_status = intr_disable();
-  ASSERT(!list_elem_find(&thread_ready_list, &user_thread->general_tag));
-  list_append(&thread_ready_list, &user_thread->general_tag);
+  thread_ready(user_thread);
   ASSERT(!list_elem_find(&thread_all_list, &user_thread->all_list_tag));
   list_append(&thread_all_list, &user_thread->all_list_tag);
   intr_set_status(old_status);
@@ -7,10 +7,12 @@
 
 #include "thread.h"
 #define USER_VADDR_START 0x8048000
+/* the heap grows up from here, far above the image and the low mappings */
+#define USER_BRK_START 0x40000000
 #define default_prio 31
 
 void process_execute(void *filename, char *name);
 void process_activate(struct task_struct *pthread);
 void page_dir_activate(struct task_struct *pthread);
-uint32_t *create_page_dir(void);
+pte_t *create_page_dir(struct task_struct *pthread);
 #endif
@@ -2,18 +2,22 @@
  * Author: Zhang Xun |
  * Time: 2023-11-28 |
  */
+#include "alloc_trace.h"
 #include "console.h"
 #include "exec.h"
 #include "fork.h"
 #include "fs.h"
+#include "page_cache.h"
 #include "print.h"
+#include "shm.h"
 #include "stdint.h"
 #include "stdio_kernel.h"
 #include "string.h"
 #include "syscall.h"
 #include "thread.h"
+#include "timer.h"
 
-#define syscall_nr 32
+#define syscall_nr 33
 typedef void *syscall;
 syscall syscall_table[syscall_nr];
 
@@ -43,5 +47,17 @@ void syscall_init() {
   syscall_table[SYS_STAT] = sys_stat;
   syscall_table[SYS_PS] = sys_ps;
   syscall_table[SYS_EXECV] = sys_execv;
+  syscall_table[SYS_SHMGET] = sys_shmget;
+  syscall_table[SYS_SHMAT] = sys_shmat;
+  syscall_table[SYS_SHMDT] = sys_shmdt;
+  syscall_table[SYS_SHMRM] = sys_shmrm;
+  syscall_table[SYS_MMAP] = sys_mmap;
+  syscall_table[SYS_MUNMAP] = sys_munmap;
+  syscall_table[SYS_ALLOC_DUMP] = sys_alloc_dump;
+  syscall_table[SYS_BRK] = sys_brk;
+  syscall_table[SYS_MEMINFO] = sys_meminfo;
+  syscall_table[SYS_SETPRIORITY] = sys_setpriority;
+  syscall_table[SYS_SLEEP] = sys_sleep;
+  syscall_table[SYS_CLOCK_GETTIME] = sys_clock_gettime;
   put_str("syscall_init done\n");
 }
@@ -2,4 +2,6 @@
 #define __USERPROG_USERPROG_H
 
 #define USER_STACK3_VADDR (0xc0000000 - 0x1000)
+/* the user stack grows on page faults down to 0xc0000000 - USER_STACK_LIMIT */
+#define USER_STACK_LIMIT 0x800000
 #endif